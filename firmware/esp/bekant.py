@@ -1,7 +1,14 @@
 from machine import Pin, UART
+import time
 
 VERSION = 20250813
 HOST_STX = 0x4C
+HOST_STX_SEQUENCED = 0x53
+HOST_PIPELINE_DEPTH = 4     # rx queue of the desk controller
+TELEMETRY_FRAME_LENGTH = 10
+HOST_BAUDRATES = (115200, 250000, 500000, 1000000)
+HOST_BAUD_SWITCH_TIME_MS = 2        # the desk controller switches with its next main loop
+HOST_BAUD_CONFIRM_TIME_MS = 100     # fallback to 115200 without a valid request
 
 
 def position_to_height(position:int, offset:int=0, unit:str="cm") -> int:
@@ -21,6 +28,9 @@ class Bekant:
         GET_DESK_POSITION           = 0x12
         GET_DESK_UPPER_LIMIT        = 0x13
         GET_DESK_LOWER_LIMIT        = 0x14
+        GET_DESK_SNAPSHOT           = 0x15
+        GET_DESK_BUS_ERRORS         = 0x16
+        GET_DESK_WAYPOINTS          = 0x17
 
         GET_MOTOR_LEFT_STATE        = 0x20
         GET_MOTOR_LEFT_POSITION     = 0x21
@@ -44,12 +54,17 @@ class Bekant:
 
         SET_DESK_POSITION           = 0x50
         SET_DESK_HALT               = 0x51
+        SET_DESK_STREAM             = 0x52
+        SET_DESK_WAYPOINT           = 0x54
+
+        PUSH_DESK_TELEMETRY         = 0x60
 
         GET_PROTOCOL_VERSION        = 0x70
         GET_FIRMWARE_VERSION        = 0x71
         GET_BOARD_REVISION          = 0x72
         CALL_WATCHDOG_ENABLE        = 0x73
         CALL_WATCHDOG_DISABLE       = 0x74
+        SET_HOST_BAUDRATE           = 0x75
 
 
     class State:
@@ -84,8 +99,23 @@ class Bekant:
         OPERATION_CALIBRATING_DONE  = 0x4A
         OPERATION_LIMIT_UP          = 0x4B  # not implemented	
         OPERATION_LIMIT_DOWN        = 0x4C  # not implemented
+        OPERATION_MOVING_FINE       = 0x4D
+        OPERATION_DWELLING          = 0x4E  # rests at a waypoint before the next one
     
 
+    class Stream:
+        OFF                         = 0x00
+        CYCLE                       = 0x01  # after every lin cycle
+        CHANGE                      = 0x02  # only if state, position or drift changed
+
+
+    class Baudrate:
+        BAUD_115200                 = 0x00  # default after a reset of the desk controller
+        BAUD_250000                 = 0x01
+        BAUD_500000                 = 0x02
+        BAUD_1000000                = 0x03
+
+
     class Error:
         NO_ERROR                    = 0x00
 
@@ -108,10 +138,14 @@ class Bekant:
         DESK_TARGET_POSITION        = 0xD8
         DESK_UPPER_LIMIT            = 0xD9
         DESK_LOWER_LIMIT            = 0xDA
+        DESK_QUEUE_FULL             = 0xDB
 
       
     def __init__(self):
-        self.uart = UART(2, baudrate=115200, rx=16, tx=17, timeout=80)
+        self.uart = UART(2, baudrate=HOST_BAUDRATES[Bekant.Baudrate.BAUD_115200], rx=16, tx=17, timeout=80)
+        self._telemetry = None
+        self._pending = b''
+        self._sequence = 0
     
     
     def _checksum(self, data: bytes) -> bytes:
@@ -122,17 +156,93 @@ class Bekant:
     
 
     def _flush_uart(self):
+        # telemetry pushed since the last request is kept, everything else is dropped
         while self.uart.any():
-            self.uart.read()
+            self._parse_telemetry(self.uart.read())
+
+
+    def _parse_telemetry(self, data: bytes):
+        # [STX] [0xE0] [LEN] [ERR] [SEQ] [STATE] [POSITION] [DRIFT] [CC]
+        data = self._pending + (data or b'')
+        self._pending = b''
+        push_cmd = (Bekant.Command.PUSH_DESK_TELEMETRY | 0x80)
+
+        i = 0
+        while ((i + TELEMETRY_FRAME_LENGTH) <= len(data)):
+            frame = data[i:(i + TELEMETRY_FRAME_LENGTH)]
+            if ((frame[0] == HOST_STX) and (frame[1] == push_cmd) and (self._checksum(frame[:-1])[0] == frame[-1])):
+                self._telemetry = {
+                    "sequence": frame[4],
+                    "state": frame[5],
+                    "position": int.from_bytes(frame[6:8], 'big'),
+                    "drift": frame[8]
+                }
+                i += TELEMETRY_FRAME_LENGTH
+            else:
+                i += 1
+
+        # a frame still on the wire is completed with the next read
+        tail = data[i:]
+        while ((len(tail) > 0) and ((tail[0] != HOST_STX) or ((len(tail) > 1) and (tail[1] != push_cmd)))):
+            tail = tail[1:]
+        self._pending = tail
+
+
+    def _read_sequenced(self) -> bytes:
+        # returns the next valid sequenced frame or None on timeout. 
+        # pushed telemetry uses the plain framing and is kept aside.
+        while True:
+            frame = self.uart.read(1)
+            if (frame == None):
+                return None
+
+            if (frame[0] == HOST_STX):
+                self._parse_telemetry(frame + (self.uart.read(TELEMETRY_FRAME_LENGTH - 1) or b''))
+                self._pending = b''
+
+            elif (frame[0] == HOST_STX_SEQUENCED):
+                frame += (self.uart.read(3) or b'')
+                if (len(frame) < 4):
+                    return None
+
+                frame += (self.uart.read(frame[3] + 1) or b'')
+                if ((len(frame) == (frame[3] + 5)) and (self._checksum(frame[:-1])[0] == frame[-1])):
+                    return frame
+
+
+    def _read(self, length: int) -> bytes:
+        # frames pushed by the desk controller may precede the response
+        push_cmd = (Bekant.Command.PUSH_DESK_TELEMETRY | 0x80)
+
+        if (len(self._pending) > 0):
+            self._parse_telemetry(self.uart.read(TELEMETRY_FRAME_LENGTH - len(self._pending)))
+            self._pending = b''
+
+        response = self.uart.read(length)
+        while ((response != None) and (len(response) > 1) and (response[1] == push_cmd)):
+            if (len(response) < TELEMETRY_FRAME_LENGTH):
+                response += (self.uart.read(TELEMETRY_FRAME_LENGTH - len(response)) or b'')
+
+            self._parse_telemetry(response[:TELEMETRY_FRAME_LENGTH])
+            self._pending = b''
+            response = response[TELEMETRY_FRAME_LENGTH:]
+            response += (self.uart.read(length - len(response)) or b'')
+            response = (response or None)
+
+        return response
     
     
-    def _create_packet(self, command: Bekant.Command, data: bytes = None) -> bytes:
+    def _create_packet(self, command: Bekant.Command, data: bytes = None, sequence: int = None) -> bytes:
         # structure of a data packet:
         # [STX] [CMD] [LEN (of data)] [opt. DATA] [CC]
+        # [STX_SEQ] [SEQ] [CMD] [LEN (of data)] [opt. DATA] [CC]
         data = data or b''
         length = len(data)
         
-        packet = bytes([HOST_STX, command, length])
+        if (sequence == None):
+            packet = bytes([HOST_STX, command, length])
+        else:
+            packet = bytes([HOST_STX_SEQUENCED, sequence, command, length])
         
         if (length > 0):
             packet += data
@@ -200,6 +310,9 @@ class Bekant:
             elif (packet[3] == 0x0A):
                 err_arg = Bekant.Error.DESK_LOWER_LIMIT
                 err_msg += "0x0A (lower limit reached)."
+            elif (packet[3] == 0x0B):
+                err_arg = Bekant.Error.DESK_QUEUE_FULL
+                err_msg += "0x0B (waypoint queue is full)."
             else:
                 err_arg = Bekant.Error.DESK_GENERAL_ERROR
                 err_msg = "desk responded an unknown error code: " + str(packet[3])
@@ -216,7 +329,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.CALL_DESK_INIT)
         self.uart.write(request)
         
-        response = self.uart.read(5)
+        response = self._read(5)
         if (response != None):
             try:
                 self._inspect_packet(Bekant.Command.CALL_DESK_INIT, 5, response)
@@ -236,7 +349,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.CALL_DESK_DEINIT)
         self.uart.write(request)
         
-        response = self.uart.read(5)
+        response = self._read(5)
         if (response != None):
             try:
                 self._inspect_packet(Bekant.Command.CALL_DESK_DEINIT, 5, response)
@@ -260,7 +373,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.CALL_DESK_CALIBRATION)
         self.uart.write(request)
         
-        response = self.uart.read(5)
+        response = self._read(5)
         if (response != None):
             try:
                 self._inspect_packet(Bekant.Command.CALL_DESK_CALIBRATION, 5, response)
@@ -280,7 +393,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.SET_DESK_HALT)
         self.uart.write(request)
         
-        response = self.uart.read(5)
+        response = self._read(5)
         if (response != None):
             try:
                 self._inspect_packet(Bekant.Command.SET_DESK_HALT, 5, response)
@@ -300,7 +413,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.GET_DESK_STATE)
         self.uart.write(request)
         
-        response = self.uart.read(6)        
+        response = self._read(6)        
         if (response != None):
             try:
                 self._inspect_packet(Bekant.Command.GET_DESK_STATE, 6, response)
@@ -323,7 +436,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.GET_DESK_DRIFT)
         self.uart.write(request)
         
-        response = self.uart.read(6)        
+        response = self._read(6)        
         if (response != None):   
             try:
                 self._inspect_packet(Bekant.Command.GET_DESK_DRIFT, 6, response)
@@ -348,7 +461,7 @@ class Bekant:
         #print(request.hex())
         self.uart.write(request)
         
-        response = self.uart.read(7)        
+        response = self._read(7)        
         if (response != None):
         #print(response.hex())
         #print("***************")
@@ -369,6 +482,71 @@ class Bekant:
             raise Exception("Error (get_position): UART Timeout", Bekant.Error.HOST_TIMEOUT)
         
         
+    def get_snapshot(self) -> dict:
+        self._flush_uart()
+        request = self._create_packet(Bekant.Command.GET_DESK_SNAPSHOT)
+        self.uart.write(request)
+        
+        response = self._read(18)
+        if (response != None):
+            try:
+                self._inspect_packet(Bekant.Command.GET_DESK_SNAPSHOT, 18, response)
+
+            except Exception as e:
+                err_msg = "Error in 'get_snapshot': " + e.args[0]
+                err_arg = e.args[1]
+                raise Exception(err_msg, err_arg)
+            
+            else:
+                # [SEQ] [STATE] [POSITION] [DRIFT] 2x [POSITION] [STATE] [OUTAGES]
+                return {
+                    "sequence": response[4],
+                    "state": response[5],
+                    "position": int.from_bytes(response[6:8], 'big'),
+                    "drift": response[8],
+                    "left_position": int.from_bytes(response[9:11], 'big'),
+                    "left_state": response[11],
+                    "left_outages": response[12],
+                    "right_position": int.from_bytes(response[13:15], 'big'),
+                    "right_state": response[15],
+                    "right_outages": response[16]
+                }
+            
+        else:
+            self._flush_uart()
+            raise Exception("Error (get_snapshot): UART Timeout", Bekant.Error.HOST_TIMEOUT)
+        
+        
+    def get_bus_errors(self, node_id: int) -> dict:
+        self._flush_uart()
+        request = self._create_packet(Bekant.Command.GET_DESK_BUS_ERRORS, bytes([node_id]))
+        self.uart.write(request)
+        
+        response = self._read(10)
+        if (response != None):
+            try:
+                self._inspect_packet(Bekant.Command.GET_DESK_BUS_ERRORS, 10, response)
+
+            except Exception as e:
+                err_msg = "Error in 'get_bus_errors': " + e.args[0]
+                err_arg = e.args[1]
+                raise Exception(err_msg, err_arg)
+            
+            else:
+                # [CHECKSUM] [MISSING] [FRAMING] [OVERRUN] [ECHO], saturating at 255
+                return {
+                    "checksum": response[4],
+                    "missing": response[5],
+                    "framing": response[6],
+                    "overrun": response[7],
+                    "echo": response[8]
+                }
+            
+        else:
+            self._flush_uart()
+            raise Exception("Error (get_bus_errors): UART Timeout", Bekant.Error.HOST_TIMEOUT)
+        
+        
     #@position.setter
     def set_position(self, position: int):
         self._flush_uart()
@@ -376,7 +554,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.SET_DESK_POSITION, bytes_position)
         self.uart.write(request)
         
-        response = self.uart.read(5)
+        response = self._read(5)
         if (response != None):
             try:
                 self._inspect_packet(Bekant.Command.SET_DESK_POSITION, 5, response)
@@ -391,12 +569,62 @@ class Bekant:
             raise Exception("Error (set_position): UART Timeout", Bekant.Error.HOST_TIMEOUT)
 
 
+    def get_waypoints(self) -> int: 
+        self._flush_uart()
+        request = self._create_packet(Bekant.Command.GET_DESK_WAYPOINTS)
+        self.uart.write(request)
+        
+        response = self._read(6)        
+        if (response != None):
+            try:
+                self._inspect_packet(Bekant.Command.GET_DESK_WAYPOINTS, 6, response)
+
+            except Exception as e:
+                err_msg = "Error in 'get_waypoints': " + e.args[0]
+                err_arg = e.args[1]
+                raise Exception(err_msg, err_arg)
+            
+            else:
+                return response[4]
+
+        else:
+            self._flush_uart()
+            raise Exception("Error (get_waypoints): UART Timeout", Bekant.Error.HOST_TIMEOUT)
+
+
+    def add_waypoint(self, position: int, dwell_ms: int = 0) -> int:
+        # queued on the desk controller, which moves on by itself. the state stays 
+        # out of OPERATION_NORMAL until the last waypoint is reached. set_position() 
+        # and stop() drop the rest of the route.
+        self._flush_uart()
+        dwell = (dwell_ms // 100)
+        request = self._create_packet(Bekant.Command.SET_DESK_WAYPOINT, position.to_bytes(2, 'big', False) + dwell.to_bytes(2, 'big', False))
+        self.uart.write(request)
+        
+        response = self._read(6)
+        if (response != None):
+            try:
+                self._inspect_packet(Bekant.Command.SET_DESK_WAYPOINT, 6, response)
+
+            except Exception as e:
+                err_msg = "Error in 'add_waypoint': " + e.args[0]
+                err_arg = e.args[1]
+                raise Exception(err_msg, err_arg)
+            
+            else:
+                return response[4]
+
+        else:
+            self._flush_uart()
+            raise Exception("Error (add_waypoint): UART Timeout", Bekant.Error.HOST_TIMEOUT)
+
+
     def get_upper_limit(self) -> int:
         self._flush_uart()
         request = self._create_packet(Bekant.Command.GET_DESK_UPPER_LIMIT)
         self.uart.write(request)
         
-        response = self.uart.read(7)
+        response = self._read(7)
         if (response != None):
             try:
                 self._inspect_packet(Bekant.Command.GET_DESK_UPPER_LIMIT, 7, response)
@@ -421,7 +649,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.GET_DESK_LOWER_LIMIT)
         self.uart.write(request)
         
-        response = self.uart.read(7)
+        response = self._read(7)
         if (response != None):
             try:
                 self._inspect_packet(Bekant.Command.GET_DESK_LOWER_LIMIT, 7, response)
@@ -456,7 +684,7 @@ class Bekant:
         
         self._flush_uart()
         self.uart.write(request)
-        response = self.uart.read(6)
+        response = self._read(6)
         if (response != None):
             if (unit == "left"):
                 try: 
@@ -497,7 +725,7 @@ class Bekant:
         
         self._flush_uart()
         self.uart.write(request)
-        response = self.uart.read(6)
+        response = self._read(6)
         if (response != None):
             if (unit == "left"):
                 try:
@@ -538,7 +766,7 @@ class Bekant:
         
         self._flush_uart()
         self.uart.write(request)
-        response = self.uart.read(6)
+        response = self._read(6)
         if (response != None):
             if (unit == "left"):
                 try: 
@@ -579,7 +807,7 @@ class Bekant:
         
         self._flush_uart()
         self.uart.write(request)
-        response = self.uart.read(6)
+        response = self._read(6)
         if (response != None):
             if (unit == "left"):
                 try:
@@ -620,7 +848,7 @@ class Bekant:
 
         self._flush_uart()
         self.uart.write(request)
-        response = self.uart.read(7)
+        response = self._read(7)
         if (response != None):
             if (unit == "left"):
                 try:
@@ -663,7 +891,7 @@ class Bekant:
         
         self._flush_uart()
         self.uart.write(request)
-        response = self.uart.read(7)
+        response = self._read(7)
         if (response != None):
 
             if (unit == "left"):
@@ -707,7 +935,7 @@ class Bekant:
         
         self._flush_uart()
         self.uart.write(request)
-        response = self.uart.read(7)
+        response = self._read(7)
         if (response != None):
 
             if (unit == "left"):
@@ -746,7 +974,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.GET_FIRMWARE_VERSION)        
         self.uart.write(request)        
 
-        response = self.uart.read(8)
+        response = self._read(8)
         if (response != None):
             try:
                 self._inspect_packet(Bekant.Command.GET_FIRMWARE_VERSION, 8, response)
@@ -772,7 +1000,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.GET_BOARD_REVISION)
         self.uart.write(request)
         
-        response = self.uart.read(8)
+        response = self._read(8)
         if (response != None):
             try: 
                 self._inspect_packet(Bekant.Command.GET_BOARD_REVISION, 8, response)
@@ -796,7 +1024,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.CALL_WATCHDOG_ENABLE)
         
         self.uart.write(request)        
-        response = self.uart.read(5)
+        response = self._read(5)
         if (response != None):
             try:
                 self._inspect_packet(Bekant.Command.CALL_WATCHDOG_ENABLE, 5, response)
@@ -816,7 +1044,7 @@ class Bekant:
         request = self._create_packet(Bekant.Command.CALL_WATCHDOG_DISABLE)
         
         self.uart.write(request)        
-        response = self.uart.read(5)
+        response = self._read(5)
         if (response != None):
             try:
                 self._inspect_packet(Bekant.Command.CALL_WATCHDOG_DISABLE, 5, response)
@@ -829,3 +1057,104 @@ class Bekant:
         else:
             self._flush_uart()
             raise Exception("Error (watchdog_disable): UART Timeout", Bekant.Error.HOST_TIMEOUT)
+    
+
+    def stream(self, mode: int):
+        self._flush_uart()
+        request = self._create_packet(Bekant.Command.SET_DESK_STREAM, bytes([mode]))
+        
+        self.uart.write(request)        
+        response = self._read(5)
+        if (response != None):
+            try:
+                self._inspect_packet(Bekant.Command.SET_DESK_STREAM, 5, response)
+
+            except Exception as e:
+                err_msg = "Error in 'stream': " + e.args[0]
+                err_arg = e.args[1]
+                raise Exception(err_msg, err_arg)
+
+        else:
+            self._flush_uart()
+            raise Exception("Error (stream): UART Timeout", Bekant.Error.HOST_TIMEOUT)
+
+
+    def set_baudrate(self, rate: int) -> bool:
+        # the request is acknowledged at the current rate, then both sides switch over 
+        # and the new rate is confirmed with another request. returns False if the 
+        # confirmation failed and both sides are back at 115200.
+        self._flush_uart()
+        request = self._create_packet(Bekant.Command.SET_HOST_BAUDRATE, bytes([rate]))
+        
+        self.uart.write(request)        
+        response = self._read(5)
+        if (response != None):
+            try:
+                self._inspect_packet(Bekant.Command.SET_HOST_BAUDRATE, 5, response)
+
+            except Exception as e:
+                err_msg = "Error in 'set_baudrate': " + e.args[0]
+                err_arg = e.args[1]
+                raise Exception(err_msg, err_arg)
+
+        else:
+            self._flush_uart()
+            raise Exception("Error (set_baudrate): UART Timeout", Bekant.Error.HOST_TIMEOUT)
+
+        time.sleep_ms(HOST_BAUD_SWITCH_TIME_MS)
+        self.uart.init(baudrate=HOST_BAUDRATES[rate], rx=16, tx=17, timeout=80)
+
+        try:
+            self.get_firmware_version()
+        except Exception:
+            # the desk controller falls back on its own once the window has passed
+            self.reset_baudrate()
+            time.sleep_ms(HOST_BAUD_CONFIRM_TIME_MS)
+            self._flush_uart()
+            return False
+
+        return True
+
+
+    def reset_baudrate(self):
+        # the desk controller starts at 115200 after every reset
+        self.uart.init(baudrate=HOST_BAUDRATES[Bekant.Baudrate.BAUD_115200], rx=16, tx=17, timeout=80)
+        self._pending = b''
+
+
+    def read_telemetry(self) -> dict:
+        # does not block. returns the latest pushed telemetry or None if nothing arrived.
+        self._flush_uart()
+        telemetry = self._telemetry
+        self._telemetry = None
+        return telemetry
+
+
+    def pipeline(self, requests: list) -> list:
+        # requests is a list of (command, data) tuples. up to HOST_PIPELINE_DEPTH of them
+        # are in flight, the responses are matched by their sequence number. returns the 
+        # payload behind the error code of every response in the order of the requests, 
+        # None for requests which failed or timed out.
+        self._flush_uart()
+        results = [None] * len(requests)
+        pending = {}
+        sent = 0
+
+        while ((sent < len(requests)) or (len(pending) > 0)):
+            while ((sent < len(requests)) and (len(pending) < HOST_PIPELINE_DEPTH)):
+                command, data = requests[sent]
+                self._sequence = ((self._sequence + 1) & 0xFF)
+                pending[self._sequence] = sent
+                self.uart.write(self._create_packet(command, data, self._sequence))
+                sent += 1
+
+            # [STX_SEQ] [SEQ] [CMD] [LEN] [ERR] [opt. DATA] [CC]
+            frame = self._read_sequenced()
+            if (frame == None):
+                break
+
+            index = pending.pop(frame[1], None)
+            if ((index != None) and (frame[2] == (requests[index][0] | 0x80)) and (frame[3] > 0) and (frame[4] == 0x00)):
+                results[index] = frame[5:-1]
+
+        return results
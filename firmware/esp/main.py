@@ -12,6 +12,8 @@ MOVING_BUTTON_DELAY_TIME_MS = 200
 MEMORY_BUTTON_DELAY_TIME_MS = 500
 SETTINGS_ENTER_DELAY_TIME_MS = 2000
 SETTINGS_LEAVE_DELAY_TIME_MS = 4000
+STREAM_KEEPALIVE_TIME_MS = 300
+HOST_BAUDRATE = bekant.Bekant.Baudrate.BAUD_1000000
 
 PIN_RESET_BUTTON = Pin(14)
 PIN_BOARD_LED = Pin(27)
@@ -37,6 +39,8 @@ class StartupPhase:
     READ_UPPER_LIMIT        = 0x13
     READ_LOWER_LIMIT        = 0x14
     WATCHDOG                = 0x15
+    STREAM                  = 0x16
+    BAUDRATE                = 0x17
 
 class RunningPhase:
     NONE                    = 0x20
@@ -318,6 +322,7 @@ prev_phase = OperatingPhase.NONE
 
 error_count = 0
 reset_button_delay = 0
+stream_keepalive_count = 0
 startup_delay_count = 0
 restart_delay_count = 0
 
@@ -503,25 +508,63 @@ while True:
                 else:
                     error_count = 0
                     debug(Verbosity.NORMAL, "Watchdog Enabled!") 
+                    host_state["phase"] = StartupPhase.BAUDRATE
+
+
+            elif (host_state["phase"] == StartupPhase.BAUDRATE):
+                try:
+                    negotiated = desk.set_baudrate(HOST_BAUDRATE)
+
+                except Exception as e:
+                    error_count += 1
+                    debug(Verbosity.DEBUG, e)
+                else:
+                    # a failed negotiation is no error, the desk controller stays at 115200
+                    error_count = 0
+                    debug_msg = "Host Baudrate: " + str(bekant.HOST_BAUDRATES[HOST_BAUDRATE if negotiated else 0])
+                    debug(Verbosity.NORMAL, debug_msg)
+                    host_state["phase"] = StartupPhase.STREAM
+
+
+            elif (host_state["phase"] == StartupPhase.STREAM):
+                try:
+                    desk.stream(desk.Stream.CHANGE)
+                    
+                except Exception as e:
+                    error_count += 1
+                    debug(Verbosity.DEBUG, e)
+                else:
+                    error_count = 0
+                    stream_keepalive_count = 0
                     host_state["op_mode"] = OperatingMode.RUNNING
                     host_state["phase"] = RunningPhase.SLEEP
         
 
         elif (host_state["op_mode"] == OperatingMode.RUNNING):
-            try:
-                desk_position = desk.get_position()  
-
-            except Exception as e:
-                error_count += 1
-                debug_msg = "Could not read desk position: " + e.args[0]
-                debug(Verbosity.DEBUG, debug_msg)
+            # the position is pushed by the desk controller, no need to poll it
+            telemetry = desk.read_telemetry()
+            if (telemetry != None):
+                desk_position = telemetry["position"]
             
-            else:
-                if (desk_position == 0):
-                    debug(Verbosity.DEBUG, "No valid position was returned.")
+            stream_keepalive_count += 1
+            if ((stream_keepalive_count * TIMER_PERIOD_MS) >= STREAM_KEEPALIVE_TIME_MS):
+                # the controller only feeds its watchdog on requests. renewing the
+                # subscription also restarts the stream after a reset of the controller.
+                try:
+                    desk.stream(desk.Stream.CHANGE)
+
+                except Exception as e:
                     error_count += 1
+                    debug_msg = "Could not renew the telemetry stream: " + e.args[0]
+                    debug(Verbosity.DEBUG, debug_msg)
+            
                 else:
-                    error_count = 0
+                    stream_keepalive_count = 0
+                    if (desk_position == 0):
+                        debug(Verbosity.DEBUG, "No valid position was received.")
+                        error_count += 1
+                    else:
+                        error_count = 0
             
 
             if (host_state["phase"] == RunningPhase.WAKE_UP):
@@ -666,6 +709,28 @@ while True:
                 
                 elif ((len(hmi_keys) == 1) and (temp_button in hmi_keys)):
                     pass
+                
+                elif ((len(hmi_keys) == 1) and (temp_button == hmi.Keys.BUTTON_NONE) and 
+                      (hmi_keys[0] in {hmi.Keys.BUTTON_1, hmi.Keys.BUTTON_2, hmi.Keys.BUTTON_3, hmi.Keys.BUTTON_4})):
+                    # another memory position, the controller takes it up on the fly
+                    if (hmi_keys[0] == hmi.Keys.BUTTON_1):
+                        target_position = config["desk_position_1"]
+                    elif (hmi_keys[0] == hmi.Keys.BUTTON_2):
+                        target_position = config["desk_position_2"]
+                    elif (hmi_keys[0] == hmi.Keys.BUTTON_3):
+                        target_position = config["desk_position_3"]
+                    else:
+                        target_position = config["desk_position_4"]
+                    
+                    try:
+                        desk.set_position(target_position)
+                        debug_msg = "Moving on to " + str(target_position)
+                        debug(Verbosity.NORMAL, debug_msg)
+                    except Exception as e:
+                        debug_msg = "Missed set_position in moving_automatic: " + e.args[0]
+                        debug(Verbosity.DEBUG, debug_msg)
+                    else:
+                        temp_button = hmi_keys[0]
             
                 else:
                     try:
@@ -1000,6 +1065,7 @@ while True:
 
             if (restart_delay_count > 10):
                 debug(Verbosity.NORMAL, "Trying to re-init the desk controller...")
+                desk.reset_baudrate()
                 error_count = 0
                 host_state["op_mode"] = OperatingMode.IDLE
                 host_state["phase"] = OperatingPhase.NONE
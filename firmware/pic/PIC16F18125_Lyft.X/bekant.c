@@ -6,6 +6,7 @@
  */
 #include "bekant.h"
 #include "lin.h"
+#include "nvm.h"
 
 
 bool    startup_readback;
@@ -13,17 +14,110 @@ uint8_t startup_nodeCounter;
 uint8_t startup_nodeIdentifier;
 uint8_t startup_nodeFound;
 uint8_t startup_retryCounter;
+uint8_t startup_cacheIndex;
+bool    startup_cached;
+bool    startup_quickScan = STARTUP_QUICK_SCAN_DEFAULT;
+bool    startup_adaptive = STARTUP_ADAPTIVE_DEFAULT;
+volatile bool startup_frameDone;
 
 uint8_t timekeeper;
 uint8_t rescueCounter;
 uint8_t rescueCommand;
 uint8_t proximityCounter;
+bool    proximityUp;                /**< direction of the move which is slowed down */
+bool    fineBurst;                  /**< MOVE_SLOW of a fine move, otherwise it waits for the desk to rest */
+uint8_t finePulses;
+bool    targetRequested;            /**< the host set a target, OPERATION_NORMAL takes it up */
+bool    retargetPending;            /**< a target which is taken up once the desk rests */
+uint16_t retargetPosition;
+bool    retargetHalted;             /**< the move was cut short, its stop is not learned from */
+uint8_t motionVelocity;             /**< position units per cycle, measured at the motor command */
+uint16_t motionPosition;            /**< desk position at the last fresh sample of the left motor */
+uint16_t motionSpan;                /**< ticks from the sample at motionPosition to the latest fresh one */
+uint16_t motionStale;               /**< ticks the latest fresh sample is older than the last read of the left motor */
+uint8_t motionTicks;                /**< ticks since the last read of the left motor */
+uint8_t motionRest;                 /**< fresh samples in a row without travel */
+bool    tuningPending;              /**< a stopped move is learned from once the desk rests */
+bool    tuningDirty;                /**< the corrections differ from the eeprom */
+bool    tuningUp;
+uint16_t tuningTarget;
+uint8_t waypointHead;               /**< next waypoint to be taken up */
+uint8_t waypointCount;
+uint16_t waypointDwell;             /**< lin cycles to rest at the waypoint of the current move */
 
 bool    desk_isTalking;
+bool    desk_isUnpublished;         /**< samples of the running cycle the snapshot does not show yet */
+
+uint8_t schedule_index;
+uint8_t schedule_sequence;          /**< counts the samples of both motors */
+uint8_t schedule_active;
+uint8_t schedule_next = DESK_SCHEDULE_DEFAULT;
+const struct desk_slot *schedule_readSlot;
+bool    schedule_eventDriven = DESK_EVENT_DRIVEN_DEFAULT;
 
 struct desk_instance desk;
 struct node_instance node[UNIT_MAX];
 struct motor_instance motor[UNIT_MAX];
+struct desk_cache startup_cache;
+struct desk_tuning tuning;
+struct desk_waypoint waypoint[DESK_WAYPOINTS];
+
+// the getters read the published copy, the desk routines work on the live data
+struct desk_snapshot desk_view[2];
+uint8_t desk_viewIndex;
+
+// not cleared by the runtime startup code, survives a watchdog or brown-out reset
+__persistent struct desk_retention desk_retained;
+
+
+// frames with a constant payload. the heartbeat uses the enhanced checksum, 
+// which covers the protected id. the diagnostic frames use the classic one.
+static const struct lin_frame frame_heartbeat = {
+    LIN_PID(DESK_ADDR_SEVENTEEN), DESK_PACKET_LEN, LIN_CHECKSUM(LIN_PID(DESK_ADDR_SEVENTEEN)), { 0x00, 0x00, 0x00 }
+};
+static const struct lin_frame frame_announcement = LIN_DIAG_FRAME(0xFF, 0x07, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+static const struct lin_frame frame_preprocessing[2] = {
+    LIN_DIAG_FRAME(0xFF, 0x01, 0x07, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF),
+    LIN_DIAG_FRAME(0xD0, 0x02, 0x07, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF)
+};
+
+// original bus traffic of the bekant controller: the motors are sampled once, 
+// followed by empty reads of nodes which do not exist. 
+static const struct desk_slot schedule_classic[] = {
+    { DESK_FRAME_CONST, DESK_ADDR_SEVENTEEN,   DESK_PACKET_LEN, NULL,                       1, &frame_heartbeat },
+    { DESK_FRAME_READ,  DESK_ADDR_MOTOR_LEFT,  DESK_PACKET_LEN, schedule_readMotorLeft,     1 },
+    { DESK_FRAME_READ,  DESK_ADDR_MOTOR_RIGHT, DESK_PACKET_LEN, schedule_readMotorRight,    1 },
+    { DESK_FRAME_READ,  DESK_ADDR_SIXTEEN,     0,               NULL,                       1 },
+    { DESK_FRAME_READ,  DESK_ADDR_SIXTEEN,     0,               NULL,                       1 },
+    { DESK_FRAME_READ,  DESK_ADDR_SIXTEEN,     0,               NULL,                       1 },
+    { DESK_FRAME_READ,  DESK_ADDR_SIXTEEN,     0,               NULL,                       1 },
+    { DESK_FRAME_READ,  DESK_ADDR_SIXTEEN,     0,               NULL,                       1 },
+    { DESK_FRAME_READ,  DESK_ADDR_SIXTEEN,     0,               NULL,                       1 },
+    { DESK_FRAME_READ,  DESK_ADDR_ONE,         0,               NULL,                       1 },
+    { DESK_FRAME_WRITE, DESK_ADDR_MASTER,      DESK_PACKET_LEN, schedule_writeMotorCommand, 1 },
+    { DESK_FRAME_IDLE,  0,                     0,               NULL,                       9 }
+};
+
+// same cycle time, but the motors are sampled three times. the last sample is 
+// taken right before the motor command is built. 
+static const struct desk_slot schedule_lean[] = {
+    { DESK_FRAME_CONST, DESK_ADDR_SEVENTEEN,   DESK_PACKET_LEN, NULL,                       1, &frame_heartbeat },
+    { DESK_FRAME_READ,  DESK_ADDR_MOTOR_LEFT,  DESK_PACKET_LEN, schedule_readMotorLeft,     1 },
+    { DESK_FRAME_READ,  DESK_ADDR_MOTOR_RIGHT, DESK_PACKET_LEN, schedule_readMotorRight,    1 },
+    { DESK_FRAME_IDLE,  0,                     0,               NULL,                       4 },
+    { DESK_FRAME_READ,  DESK_ADDR_MOTOR_LEFT,  DESK_PACKET_LEN, schedule_readMotorLeft,     1 },
+    { DESK_FRAME_READ,  DESK_ADDR_MOTOR_RIGHT, DESK_PACKET_LEN, schedule_readMotorRight,    1 },
+    { DESK_FRAME_IDLE,  0,                     0,               NULL,                       4 },
+    { DESK_FRAME_READ,  DESK_ADDR_MOTOR_LEFT,  DESK_PACKET_LEN, schedule_readMotorLeft,     1 },
+    { DESK_FRAME_READ,  DESK_ADDR_MOTOR_RIGHT, DESK_PACKET_LEN, schedule_readMotorRight,    1 },
+    { DESK_FRAME_WRITE, DESK_ADDR_MASTER,      DESK_PACKET_LEN, schedule_writeMotorCommand, 1 },
+    { DESK_FRAME_IDLE,  0,                     0,               NULL,                       4 }
+};
+
+static const struct desk_schedule schedule_table[DESK_SCHEDULE_MAX] = {
+    { schedule_classic, (sizeof(schedule_classic) / sizeof(schedule_classic[0])), 9 },
+    { schedule_lean,    (sizeof(schedule_lean) / sizeof(schedule_lean[0])),       2 }
+};
 
 
 void desk_init(bool enable)
@@ -32,8 +126,10 @@ void desk_init(bool enable)
     
     if (enable == true) {
         lin_init();
+        lin_setFrameCompleteCallback(&cb_desk_frameComplete);
     } else {
         lin_deinit();
+        desk_discard();
     }
             
     startup_readback = false;
@@ -41,13 +137,34 @@ void desk_init(bool enable)
     startup_nodeCounter = 0x00;
     startup_nodeIdentifier = 0x07;   
     startup_retryCounter = 0;
+    startup_cacheIndex = 0;
+    startup_cached = startup_loadCache();
+    startup_frameDone = false;
     
     desk.op_mode = IDLE;
     desk.calibrate = false;
     timekeeper = 0;
     rescueCounter = 0;
     proximityCounter = 0;
+    finePulses = 0;
+    targetRequested = false;
+    retargetPending = false;
+    retargetHalted = false;
+    waypoint_clear();
+    motionVelocity = 0;
+    motionSpan = 0;
+    motionStale = 0;
+    motionTicks = 0;
+    motionRest = 0;
+    tuningPending = false;
+    tuningDirty = false;
+    tuning_load();
     desk_isTalking = false;    
+    desk_isUnpublished = false;
+    
+    schedule_index = 0;
+    schedule_active = schedule_next;
+    schedule_readSlot = NULL;
     
     for (i=0; i<UNIT_MAX; i++)
     {
@@ -67,11 +184,44 @@ void desk_init(bool enable)
         motor[i].lower_limit = 0;
         motor[i].upper_limit = 0;        
     }
+    
+    desk_publish();
+}
+
+bool desk_resume()
+{
+    uint8_t i;
+    
+    // the pic was reset, but the motors kept their node ids and limits. 
+    // continue with the state of the last successful startup. 
+    if ((desk_retained.magic != DESK_RETAIN_MAGIC) || 
+        (desk_retained.checksum != desk_checksum((uint8_t *) &desk_retained, offsetof(struct desk_retention, checksum))))
+    {
+        desk_discard();
+        return false;
+    }
+    
+    desk = desk_retained.desk;
+    
+    for (i=0; i<UNIT_MAX; i++) {
+        node[i] = desk_retained.node[i];
+        motor[i] = desk_retained.motor[i];
+        motor[i].outage_count = 0;
+    }
+    
+    desk.op_mode = OPERATION_BEGIN;
+    desk.calibrate = false;
+    desk_isTalking = true;
+    timekeeper = 0;
+    
+    desk_publish();
+    return true;
 }
 
 void desk_startup()
 {
     if (desk.op_mode == IDLE) {
+        desk_discard();
         desk.op_mode = STARTUP_BEGIN;
         desk_isTalking = true;
         timekeeper = 0;
@@ -81,20 +231,24 @@ void desk_startup()
     {    
         timekeeper++;
 
+        // with adaptive pacing the frame complete callback ends the wait 
+        // early. the fixed spacing remains for nodes which answer late. 
         if (startup_readback == true)
         {
-            if (timekeeper > 1)
+            if ((timekeeper > 1) || (startup_frameDone == true))
             {
                 // trigger read command
-                lin_read(LIN_NODE_DIAG_RX);
+                startup_frameDone = false;
+                lin_read(LIN_NODE_DIAG_RX, LIN_DIAG_PACKET_LEN);
                 startup_readback = false;
                 timekeeper = 0;
             }         
         }
         else 
         {
-            if (timekeeper > 2)
+            if ((timekeeper > 2) || (startup_frameDone == true))
             {
+                startup_frameDone = false;
                 startup_setCycle();
 
                 switch (desk.op_mode)
@@ -155,138 +309,160 @@ void desk_startup()
                 timekeeper = 0;
             }
         }
+        
+        desk_publish();
     }
 }
 
 void desk_operation()
 {
-    const uint8_t heartbeat[DESK_PACKET_LEN] = {0x00, 0x00, 0x00};
-    uint8_t state, rx_len, rx_data[DESK_PACKET_LEN];
-    uint16_t position;
-    uint8_t motor_command[DESK_PACKET_LEN];
+    uint8_t length, data[DESK_PACKET_LEN], *rx_data;
+    const struct desk_slot *slot;
     
     if ((desk.op_mode & OPERATION) == OPERATION)
     {
-        if (timekeeper == 0)
-        {
-            desk_isTalking = true; 
-            lin_write(DESK_ADDR_SEVENTEEN, heartbeat, DESK_PACKET_LEN);
-        }
-        else if (timekeeper == 1)
-        {
-            lin_read(DESK_ADDR_MOTOR_LEFT);
+        if (motionTicks < 0xFF) {
+            motionTicks++;
         }
-        else if (timekeeper == 2)
+        
+        if (timekeeper == 0)
         {
-            // read back data from left motor
-            rx_len = lin_getRxData(rx_data);
-    
-            if (rx_len == DESK_PACKET_LEN)
+            // the response of the previous read is complete by now
+            if (schedule_readSlot != NULL)
             {
-                position = ((rx_data[1] << 8) | rx_data[0]);
-                state = rx_data[2];
-
-                motor[UNIT_LEFT].outage_count = 0;
-                motor[UNIT_LEFT].position = position;
-                motor[UNIT_LEFT].state = state;        
-            } else {
-                // if data is not valid/complete, keep previous data and 
-                // increase an error counter, which is reset after next valid reading. 
-                motor[UNIT_LEFT].outage_count++;
+                length = lin_getRxData(&rx_data);
+                
+                if (schedule_readSlot->handler != NULL) {
+                    schedule_readSlot->handler(rx_data, length);
+                }
+                
+                schedule_readSlot = NULL;
             }
-
-            lin_read(DESK_ADDR_MOTOR_RIGHT);
-        }
-        else if (timekeeper == 3)
-        {
-            // read back data from right motor          
-            rx_len = lin_getRxData(rx_data);
-    
-            if (rx_len == DESK_PACKET_LEN)
-            {
-                position = ((rx_data[1] << 8) | rx_data[0]);
-                state = rx_data[2];
-
-                motor[UNIT_RIGHT].outage_count = 0;
-                motor[UNIT_RIGHT].position = position;
-                motor[UNIT_RIGHT].state = state;        
-            } else {
-                // if data is not valid/complete, keep previous data and 
-                // increase an error counter, which is reset after next valid reading. 
-                motor[UNIT_RIGHT].outage_count++;
+            
+            if (schedule_index == 0) {
+                schedule_active = schedule_next;
             }
             
-            lin_read(DESK_ADDR_SIXTEEN);
-        }
-        else if (timekeeper == 4)
-        {
-            // update the desk position occasionally 
-            lin_getRxData(NULL); 
-            desk.current_position = motor[UNIT_LEFT].position;
-            lin_read(DESK_ADDR_SIXTEEN);
-        }
-        else if (timekeeper == 5)
-        {
-            // we can check the motor states for failures: 
-            switch (desk.op_mode)
+            slot = &schedule_table[schedule_active].slots[schedule_index];
+            
+            switch (slot->frame)
             {
-                case OPERATION_MOVING_UP:
-                    if ((motor[UNIT_LEFT].state == MOTOR_STATE_BLOCKED) || (motor[UNIT_RIGHT].state == MOTOR_STATE_BLOCKED)) {
-                       rescueCounter = 0;
-                       rescueCommand = MOTOR_CMD_MOVE_DOWN;
-                       desk.op_mode = OPERATION_RESCUE; // this is a severe situation
-                   } break;
-                case OPERATION_MOVING_DOWN:
-                   if ((motor[UNIT_LEFT].state == MOTOR_STATE_BLOCKED) || (motor[UNIT_RIGHT].state == MOTOR_STATE_BLOCKED)) {
-                       rescueCounter = 0;
-                       rescueCommand = MOTOR_CMD_MOVE_UP;
-                       desk.op_mode = OPERATION_RESCUE; // this is a severe situation
-                   } break;
-                case OPERATION_MOVING_SLOW:
-                    if ((motor[UNIT_LEFT].state != MOTOR_STATE_MOVING_SLOW) || (motor[UNIT_RIGHT].state != MOTOR_STATE_MOVING_SLOW)) {
-                        // no idea what to do in this case
-                    } break;
-                case OPERATION_CALIBRATING:
-                    if ((motor[UNIT_LEFT].state != MOTOR_STATE_CALIBRATING) || (motor[UNIT_RIGHT].state != MOTOR_STATE_CALIBRATING)) {
-                        // no idea what to do in this case
-                    } break;
-                default: break;
-            }
-
-            // do some empty readings (for nodes which do not exist)
-            lin_getRxData(NULL); 
-            lin_read(DESK_ADDR_SIXTEEN);
-        }
-        else if ((timekeeper >= 6) && (timekeeper <= 8))
-        {
-            // do some empty readings (for nodes which do not exist)
-            lin_getRxData(NULL); 
-            lin_read(DESK_ADDR_SIXTEEN);
-        }
-        else if (timekeeper == 9)
-        {
-            lin_getRxData(NULL); 
-            motor_controller(motor_command);
-            lin_read(DESK_ADDR_ONE);             
-        }
-        else if (timekeeper == 10)
-        {
-            // now, let the motors know about your perception
-            lin_getRxData(NULL); 
-            lin_write(DESK_ADDR_MASTER, motor_command, DESK_PACKET_LEN);            
-        }
-        else if (timekeeper == 11)
-        {
-            // transmission is done until next cycle. time for other things to handle.
-            desk_isTalking = false; 
+                case DESK_FRAME_WRITE:
+                    desk_isTalking = true;
+                    slot->handler(data, slot->length);
+                    lin_write(slot->node_id, data, slot->length);
+                    break;
+                    
+                case DESK_FRAME_READ:
+                    desk_isTalking = true;
+                    desk_isUnpublished = true;
+                    schedule_readSlot = slot;
+                    lin_read(slot->node_id, slot->length);
+                    break;
+                    
+                case DESK_FRAME_CONST:
+                    desk_isTalking = true;
+                    lin_writeFrame(slot->message);
+                    break;
+                    
+                default:
+                    // transmission is done for a while. time for other things to handle.
+                    desk_isTalking = false;
+                    break;
+            }
+            
+            timekeeper = slot->ticks;
+            schedule_index++;
+            
+            if (schedule_index >= schedule_table[schedule_active].length) {
+                schedule_index = 0;
+            }
         }
+        
+        timekeeper--;
+    }
+}
 
-        if (timekeeper > 18) {
-            timekeeper = 0;
-        } else {
-            timekeeper++;
-        }
+void desk_setSchedule(uint8_t schedule)
+{
+    // takes effect with the next cycle
+    if (schedule < DESK_SCHEDULE_MAX) {
+        schedule_next = schedule;
+    }
+}
+
+uint8_t desk_getSchedule()
+{
+    return schedule_next;
+}
+
+void desk_setEventDriven(bool enable)
+{
+    schedule_eventDriven = enable;
+}
+
+bool desk_isEventDriven()
+{
+    return schedule_eventDriven;
+}
+
+void desk_setQuickScan(bool enable)
+{
+    startup_quickScan = enable;
+}
+
+bool desk_isQuickScan()
+{
+    return startup_quickScan;
+}
+
+void desk_setAdaptiveStartup(bool enable)
+{
+    startup_adaptive = enable;
+}
+
+bool desk_isAdaptiveStartup()
+{
+    return startup_adaptive;
+}
+
+
+/*******************
+ * 
+ * S C H E D U L E   H A N D L E R S
+ * 
+ ******************/
+static void schedule_writeMotorCommand(uint8_t *data, uint8_t length)
+{
+    // now, let the motors know about your perception
+    motor_controller(data);
+    
+    // the samples and the decision based on them make up the cycle
+    desk_publish();
+}
+
+static void schedule_readMotorLeft(uint8_t *data, uint8_t length)
+{
+    motor_update(UNIT_LEFT, data, length);
+    desk.current_position = motor[UNIT_LEFT].position;
+    
+    // the lean schedule samples more than once a cycle, the age of the 
+    // position is kept in ticks rather than in cycles
+    if (motor[UNIT_LEFT].outage_count == 0) {
+        motionSpan = MIN((motionSpan + motionStale + motionTicks), 0xFFFF);
+        motionStale = 0;
+    } else {
+        motionStale = MIN((motionStale + motionTicks), 0xFFFF);
     }
+    
+    motionTicks = 0;
+}
+
+static void schedule_readMotorRight(uint8_t *data, uint8_t length)
+{
+    motor_update(UNIT_RIGHT, data, length);
+    motor_supervise();
+    schedule_sequence++;
 }
 
 
@@ -297,50 +473,78 @@ void desk_operation()
  ******************/
 bool desk_isBusy()
 {
-    return desk_isTalking;
+    // the lean schedule idles between the samples of a cycle. a request which 
+    // changes the desk waits for the snapshot, which it is checked against.
+    return ((desk_isTalking == true) || (desk_isUnpublished == true));
 }
 
 uint8_t desk_getOpMode()
 {
-    return desk.op_mode;
+    return desk_view[desk_viewIndex].op_mode;
 }
 
 uint8_t desk_getDrift()
 {
-    uint8_t drift;
-    
-    if (motor[UNIT_LEFT].position > motor[UNIT_RIGHT].position) {
-        drift = (motor[UNIT_LEFT].position - motor[UNIT_RIGHT].position);
-    } else if (motor[UNIT_LEFT].position < motor[UNIT_RIGHT].position) {
-        drift = (motor[UNIT_RIGHT].position - motor[UNIT_LEFT].position);
-    } else {
-        drift = 0;
-    }
-    
-    return drift;
+    return desk_view[desk_viewIndex].drift;
 }
 
 uint16_t desk_getUpperLimit()
 {
-    return desk.upper_limit;
+    return desk_view[desk_viewIndex].upper_limit;
 }
 
 uint16_t desk_getLowerLimit()
 {
-    return desk.lower_limit;
+    return desk_view[desk_viewIndex].lower_limit;
 }
 
 uint16_t desk_getPosition()
 {
-    return desk.current_position;
+    return desk_view[desk_viewIndex].position;
+}
+
+uint16_t desk_getStoppingDistance(bool up)
+{
+    // shortest move at full speed, and what is left of a move which is halted
+    return (uint16_t) (DESK_STOPPING_DISTANCE + tuning.correction[(up == true) ? DESK_DIRECTION_UP : DESK_DIRECTION_DOWN]);
+}
+
+uint8_t desk_getSequence()
+{
+    return desk_view[desk_viewIndex].sequence;
+}
+
+const struct desk_snapshot *desk_getSnapshot()
+{
+    // valid until the next cycle was published
+    return &desk_view[desk_viewIndex];
+}
+
+void desk_getBusErrors(uint8_t node_id, uint8_t *count)
+{
+    // counted since the last CALL_DESK_INIT, DESK_BUS_ERRORS bytes
+    lin_getErrors(node_id, count);
+}
+
+void desk_clearBusErrors()
+{
+    lin_clearErrors();
 }
 
 void desk_setPosition(uint16_t position)
 {
-    uint16_t diff;
+    uint16_t diff, halt;
+    bool up, slow, reachable;
     
     if ((position >= desk.lower_limit) && (position <= desk.upper_limit)) {
         
+        // the host takes over, the rest of a route is dropped
+        waypoint_clear();
+        
+        if (desk.op_mode == OPERATION_DWELLING) {
+            desk.op_mode = OPERATION_NORMAL;
+        }
+        
         if (desk.op_mode == OPERATION_NORMAL)
         {
             if (desk.current_position > position) {
@@ -349,24 +553,192 @@ void desk_setPosition(uint16_t position)
                 diff = (position - desk.current_position);
             }
 
-            if (diff > DESK_STOPPING_DISTANCE) {
+            if (diff > DESK_FINE_DISTANCE_MIN) {
+                desk.target_position = position;
+                targetRequested = true;
+            }
+        }
+        else if ((desk.op_mode == OPERATION_MOVING_UP) || (desk.op_mode == OPERATION_MOVING_DOWN) || 
+                 (desk.op_mode == OPERATION_MOVING_SLOW) || ((desk.op_mode == OPERATION_MOVING_FINE) && (fineBurst == true)))
+        {
+            slow = ((desk.op_mode == OPERATION_MOVING_SLOW) || (desk.op_mode == OPERATION_MOVING_FINE));
+            up = (slow == true) ? proximityUp : (desk.op_mode == OPERATION_MOVING_UP);
+            
+            // distance ahead of the desk, 0 if the new target is behind it
+            if (up == true) {
+                diff = (position > desk.current_position) ? (position - desk.current_position) : 0;
+                halt = motor_getHaltPosition(true);
+                reachable = (position > halt);
+            } else {
+                diff = (desk.current_position > position) ? (desk.current_position - position) : 0;
+                halt = motor_getHaltPosition(false);
+                reachable = (position < halt);
+            }
+            
+            if (reachable == true)
+            {
+                // same direction and far enough to stop there, the move 
+                // just goes on. at slow speed it speeds up again if it can.
+                retargetPending = false;
+                retargetHalted = false;
                 desk.target_position = position;
+                
+                if ((slow == true) && (diff > desk_getStoppingDistance(up))) {
+                    desk.op_mode = (up == true) ? OPERATION_MOVING_UP : OPERATION_MOVING_DOWN;
+                } else if (slow == true) {
+                    proximityCounter = 1;
+                }
+            }
+            else
+            {
+                // behind the desk or too close to stop in time. stop as 
+                // early as possible and come back once the desk rests.
+                retargetPending = true;
+                retargetPosition = position;
+                
+                if (desk.op_mode == OPERATION_MOVING_FINE) {
+                    desk.target_position = desk.current_position;
+                } else if (desk.op_mode != OPERATION_MOVING_SLOW) {
+                    retargetHalted = true;
+                    desk.target_position = halt;
+                }
             }
         }
-        else if (desk.op_mode == OPERATION_MOVING_UP) {
-            desk.target_position = (desk.current_position + DESK_STOPPING_DISTANCE);
+        else if (desk.op_mode == OPERATION_ANNOUNCING) {
+            // the direction is not decided yet
+            desk.target_position = position;
         }
-        else if (desk.op_mode == OPERATION_MOVING_DOWN) {
-            desk.target_position = (desk.current_position - DESK_STOPPING_DISTANCE);
+        else if ((desk.op_mode == OPERATION_MOVING_FINE) || (desk.op_mode == OPERATION_MOVING_STOP))
+        {
+            // taken up once the desk rests
+            retargetPending = true;
+            retargetPosition = position;
         }
     }
 }
 
+bool desk_halt()
+{
+    if ((desk.op_mode != OPERATION_NORMAL) && (desk.op_mode != OPERATION_DWELLING) && 
+        (desk.op_mode != OPERATION_ANNOUNCING) && (desk.op_mode != OPERATION_MOVING_UP) && 
+        (desk.op_mode != OPERATION_MOVING_DOWN) && (desk.op_mode != OPERATION_MOVING_SLOW) && 
+        (desk.op_mode != OPERATION_MOVING_FINE) && (desk.op_mode != OPERATION_MOVING_STOP)) {
+        return false;
+    }
+    
+    // nothing is left to move to, neither a pending target nor a route
+    targetRequested = false;
+    retargetPending = false;
+    waypoint_clear();
+    desk.target_position = desk.current_position;
+    
+    if ((desk.op_mode == OPERATION_MOVING_UP) || (desk.op_mode == OPERATION_MOVING_DOWN) || 
+        (desk.op_mode == OPERATION_MOVING_SLOW) || (desk.op_mode == OPERATION_MOVING_FINE)) 
+    {
+        // the motors are stopped with the next command, not learned from
+        retargetHalted = true;
+        desk.op_mode = OPERATION_MOVING_STOP;
+    }
+    else if (desk.op_mode != OPERATION_MOVING_STOP) 
+    {
+        // nothing was sent to the motors yet
+        desk.op_mode = OPERATION_NORMAL;
+    }
+    
+    return true;
+}
+
+uint8_t desk_addWaypoint(uint16_t position, uint16_t dwell)
+{
+    struct desk_waypoint *entry;
+    
+    // the number of queued waypoints, 0 if the queue is full
+    if (waypointCount >= DESK_WAYPOINTS) {
+        return 0;
+    }
+    
+    // taken up by motor_controller() once the desk rests
+    entry = &waypoint[(waypointHead + waypointCount) & (DESK_WAYPOINTS - 1)];
+    entry->position = position;
+    entry->dwell = dwell;
+    waypointCount++;
+    
+    return waypointCount;
+}
+
+uint8_t desk_getWaypoints()
+{
+    return desk_view[desk_viewIndex].waypoints;
+}
+
 void desk_runCalibration()
 {
     desk.calibrate = true;
 }
 
+static void desk_publish()
+{
+    uint8_t i;
+    struct desk_snapshot *view;
+    
+    // fill the copy nobody reads and flip the index afterwards. a reader 
+    // sees the previous cycle or this one, never a mix of both.
+    view = &desk_view[desk_viewIndex ^ 1];
+    
+    view->sequence = schedule_sequence;
+    view->op_mode = desk.op_mode;
+    view->upper_limit = desk.upper_limit;
+    view->lower_limit = desk.lower_limit;
+    view->position = desk.current_position;
+    view->waypoints = waypointCount;
+    
+    if (motor[UNIT_LEFT].position > motor[UNIT_RIGHT].position) {
+        view->drift = (motor[UNIT_LEFT].position - motor[UNIT_RIGHT].position);
+    } else if (motor[UNIT_LEFT].position < motor[UNIT_RIGHT].position) {
+        view->drift = (motor[UNIT_RIGHT].position - motor[UNIT_LEFT].position);
+    } else {
+        view->drift = 0;
+    }
+    
+    for (i=0; i<UNIT_MAX; i++) {
+        view->motor[i] = motor[i];
+    }
+    
+    desk_viewIndex ^= 1;
+    desk_isUnpublished = false;
+}
+
+static void desk_retain()
+{
+    uint8_t i;
+    
+    desk_retained.magic = DESK_RETAIN_MAGIC;
+    desk_retained.desk = desk;
+    
+    for (i=0; i<UNIT_MAX; i++) {
+        desk_retained.node[i] = node[i];
+        desk_retained.motor[i] = motor[i];
+    }
+    
+    desk_retained.checksum = desk_checksum((uint8_t *) &desk_retained, offsetof(struct desk_retention, checksum));
+}
+
+static void desk_discard()
+{
+    desk_retained.magic = 0x00;
+}
+
+static uint8_t desk_checksum(uint8_t *data, uint8_t length)
+{
+    uint8_t i, checksum = 0;
+    
+    for (i=0; i<length; i++) {
+        checksum += data[i];
+    }
+    
+    return (uint8_t) ~checksum;
+}
+
 
 /*******************
  * 
@@ -378,7 +750,7 @@ uint8_t motor_getState(uint8_t unit)
     uint8_t state = 0xFF;
     
     if (unit < UNIT_MAX) {
-        state = motor[unit].state;
+        state = desk_view[desk_viewIndex].motor[unit].state;
     }
     
     return state;
@@ -409,7 +781,7 @@ uint8_t motor_getScanId(uint8_t unit)
     uint8_t scan_id = 0xFF;
     
     if (unit < UNIT_MAX) {
-        scan_id = motor[unit].scan_id;
+        scan_id = desk_view[desk_viewIndex].motor[unit].scan_id;
     }
     
     return scan_id;
@@ -420,7 +792,7 @@ uint8_t motor_getProperty(uint8_t unit)
     uint8_t property = 0xFF; 
     
     if (unit < UNIT_MAX) {
-        property = motor[unit].property;
+        property = desk_view[desk_viewIndex].motor[unit].property;
     }
     
     return property;
@@ -431,7 +803,7 @@ uint16_t motor_getPosition(uint8_t unit)
     uint16_t position = 0xFFFF;
     
     if (unit < UNIT_MAX) {
-        position = motor[unit].position;
+        position = desk_view[desk_viewIndex].motor[unit].position;
     }
     
     return position;
@@ -442,7 +814,7 @@ uint16_t motor_getUpperLimit(uint8_t unit)
     uint16_t limit = 0xFFFF;
     
     if (unit < UNIT_MAX) {
-        limit = motor[unit].upper_limit;
+        limit = desk_view[desk_viewIndex].motor[unit].upper_limit;
     }
     
     return limit;
@@ -453,12 +825,72 @@ uint16_t motor_getLowerLimit(uint8_t unit)
     uint16_t limit = 0xFFFF;
     
     if (unit < UNIT_MAX) {
-        limit = motor[unit].lower_limit;
+        limit = desk_view[desk_viewIndex].motor[unit].lower_limit;
     }
     
     return limit;
 }
 
+uint8_t motor_getOutageCount(uint8_t unit)
+{
+    uint8_t count = 0xFF;
+    
+    if (unit < UNIT_MAX) {
+        count = desk_view[desk_viewIndex].motor[unit].outage_count;
+    }
+    
+    return count;
+}
+
+
+static void motor_update(uint8_t unit, uint8_t *data, uint8_t length)
+{
+    if (length == DESK_PACKET_LEN)
+    {
+        motor[unit].outage_count = 0;
+        motor[unit].position = ((data[1] << 8) | data[0]);
+        motor[unit].state = data[2];        
+    } else {
+        // if data is not valid/complete, keep previous data and 
+        // increase an error counter, which is reset after next valid reading. 
+        motor[unit].outage_count++;
+    }
+}
+
+static void motor_supervise()
+{
+    // we can check the motor states for failures: 
+    switch (desk.op_mode)
+    {
+        case OPERATION_MOVING_UP:
+            if ((motor[UNIT_LEFT].state == MOTOR_STATE_BLOCKED) || (motor[UNIT_RIGHT].state == MOTOR_STATE_BLOCKED)) {
+               rescueCounter = 0;
+               rescueCommand = MOTOR_CMD_MOVE_DOWN;
+               desk.op_mode = OPERATION_RESCUE; // this is a severe situation
+           } break;
+        case OPERATION_MOVING_DOWN:
+           if ((motor[UNIT_LEFT].state == MOTOR_STATE_BLOCKED) || (motor[UNIT_RIGHT].state == MOTOR_STATE_BLOCKED)) {
+               rescueCounter = 0;
+               rescueCommand = MOTOR_CMD_MOVE_UP;
+               desk.op_mode = OPERATION_RESCUE; // this is a severe situation
+           } break;
+        case OPERATION_MOVING_FINE:
+           if ((motor[UNIT_LEFT].state == MOTOR_STATE_BLOCKED) || (motor[UNIT_RIGHT].state == MOTOR_STATE_BLOCKED)) {
+               rescueCounter = 0;
+               rescueCommand = (proximityUp == true) ? MOTOR_CMD_MOVE_DOWN : MOTOR_CMD_MOVE_UP;
+               desk.op_mode = OPERATION_RESCUE;
+           } break;
+        case OPERATION_MOVING_SLOW:
+            if ((motor[UNIT_LEFT].state != MOTOR_STATE_MOVING_SLOW) || (motor[UNIT_RIGHT].state != MOTOR_STATE_MOVING_SLOW)) {
+                // no idea what to do in this case
+            } break;
+        case OPERATION_CALIBRATING:
+            if ((motor[UNIT_LEFT].state != MOTOR_STATE_CALIBRATING) || (motor[UNIT_RIGHT].state != MOTOR_STATE_CALIBRATING)) {
+                // no idea what to do in this case
+            } break;
+        default: break;
+    }
+}
 
 static void motor_controller(uint8_t *command)
 {
@@ -466,9 +898,50 @@ static void motor_controller(uint8_t *command)
     uint8_t cmd_position_lo;
     uint8_t cmd_instruction;
     uint16_t position, distance;
+    uint8_t velocity;
     
     if (command != NULL)
     {
+        // speed of the desk over the last cycle, whatever the direction. a 
+        // lost sample leaves the position of the latest fresh one, the speed 
+        // is held then and the next sample spreads its travel over the ticks 
+        // in between. on the lean schedule that may be less than a cycle.
+        if (motionSpan > 0)
+        {
+            if (desk.current_position > motionPosition) {
+                distance = (desk.current_position - motionPosition);
+            } else {
+                distance = (motionPosition - desk.current_position);
+            }
+            motionVelocity = (uint8_t) MIN((((uint32_t) distance * DESK_CYCLE_TICKS) / motionSpan), 0xFF);
+            motionPosition = desk.current_position;
+            motionSpan = 0;
+            
+            if (motionVelocity > 0) {
+                motionRest = 0;
+            } else if (motionRest < 0xFF) {
+                motionRest++;
+            }
+        }
+        
+        // an obstructed desk rests short of where the stop would have left 
+        // it, whatever the error. the motors tell, not the size of the error.
+        if ((motor[UNIT_LEFT].state == MOTOR_STATE_BLOCKED) || (motor[UNIT_RIGHT].state == MOTOR_STATE_BLOCKED) || 
+            (motor[UNIT_LEFT].state == MOTOR_STATE_ERROR) || (motor[UNIT_RIGHT].state == MOTOR_STATE_ERROR)) {
+            tuningPending = false;
+        }
+        
+        // learn from where the desk rests after a stop. the correction 
+        // goes to the eeprom, a desk which is still moving must not count.
+        if ((tuningPending == true) && (motor_isResting() == true)) {
+            tuning_update();
+            tuningPending = false;
+        }
+        
+        // the motors are stopped where they are, unless the state says otherwise
+        cmd_position_hi = (uint8_t) ((motor[UNIT_LEFT].position & 0xFF00) >> 8);
+        cmd_position_lo = (uint8_t) (motor[UNIT_LEFT].position & 0xFF);
+        cmd_instruction = MOTOR_CMD_MOVE_STOP;
     
         if (desk.op_mode == OPERATION_BEGIN)
         {
@@ -501,9 +974,24 @@ static void motor_controller(uint8_t *command)
             cmd_position_hi = (uint8_t) ((desk.current_position & 0xFF00) >> 8);
             cmd_position_lo = (uint8_t) (desk.current_position & 0xFF);            
             cmd_instruction = MOTOR_CMD_ANNOUNCEMENT;
+            tuningPending = false;
+            retargetHalted = false;
+            
+            if (desk.target_position > desk.current_position) {
+                distance = (desk.target_position - desk.current_position);
+            } else {
+                distance = (desk.current_position - desk.target_position);
+            }
             
             if (desk.calibrate == true) {
                 desk.op_mode = OPERATION_CALIBRATING;
+            } else if ((distance > 0) && (distance <= desk_getStoppingDistance(desk.target_position > desk.current_position))) {
+                // too short to get up to speed, move in bursts of MOVE_SLOW
+                proximityCounter = 0;
+                proximityUp = (desk.target_position > desk.current_position);
+                fineBurst = true;
+                finePulses++;
+                desk.op_mode = OPERATION_MOVING_FINE;
             } else if (desk.target_position > desk.current_position) {
                 desk.op_mode = OPERATION_MOVING_UP;
             } else if (desk.target_position < desk.current_position) {
@@ -513,48 +1001,115 @@ static void motor_controller(uint8_t *command)
             }
         }
         
-        else if (desk.op_mode == OPERATION_MOVING_UP)
+        else if ((desk.op_mode == OPERATION_MOVING_UP) || (desk.op_mode == OPERATION_MOVING_DOWN))
         {
-            position = motor_getLowerPosition();
-            distance = desk.target_position - desk.current_position;
-            
-            cmd_position_hi = ((position & 0xFF00) >> 8);
-            cmd_position_lo = (position & 0xFF);
-            cmd_instruction = MOTOR_CMD_MOVE_UP;
+            if (desk.op_mode == OPERATION_MOVING_UP) {
+                position = motor_getLowerPosition();
+                distance = motor_getRemainingDistance(true);
+                cmd_instruction = MOTOR_CMD_MOVE_UP;
+            } else {
+                position = motor_getHigherPosition();
+                distance = motor_getRemainingDistance(false);
+                cmd_instruction = MOTOR_CMD_MOVE_DOWN;
+            }
             
-            if (distance <= DESK_STOPPING_DISTANCE) { 
+            // slow down in this cycle if one more cycle at full speed would 
+            // not leave the approach for the slow part of the move
+            if (distance <= motor_getHaltDistance(desk.op_mode == OPERATION_MOVING_UP)) 
+            { 
                 proximityCounter = 0;
+                proximityUp = (desk.op_mode == OPERATION_MOVING_UP);
+                position = desk.target_position;
+                cmd_instruction = MOTOR_CMD_MOVE_SLOW;
                 desk.op_mode = OPERATION_MOVING_SLOW;
             }
-        }
-        
-        else if (desk.op_mode == OPERATION_MOVING_DOWN)
-        {
-            position = motor_getHigherPosition();
-            distance = desk.current_position - desk.target_position;
             
             cmd_position_hi = ((position & 0xFF00) >> 8);
             cmd_position_lo = (position & 0xFF);
-            cmd_instruction = MOTOR_CMD_MOVE_DOWN;
-            
-            if (distance <= DESK_STOPPING_DISTANCE) { 
-                proximityCounter = 0;
-                desk.op_mode = OPERATION_MOVING_SLOW;
-            }
         }
         
         else if (desk.op_mode == OPERATION_MOVING_SLOW)
         {
+            distance = motor_getRemainingDistance(proximityUp);
+            
             position = desk.target_position;
-            cmd_position_hi = (uint8_t) ((position & 0xFF00) >> 8);
-            cmd_position_lo = (uint8_t) (position & 0xFF);
             cmd_instruction = MOTOR_CMD_MOVE_SLOW;
             
             proximityCounter++;
             
-            if (proximityCounter > 2) {
+            // stop in the cycle which brings the desk to rest closest to the 
+            // target, waiting one more cycle adds the travel of a cycle. the 
+            // first cycle after MOVE_SLOW was mostly at full speed, its speed 
+            // is too high for that. only a passed target stops the desk then.
+            if ((distance == 0) || (proximityCounter > DESK_SLOW_CYCLES_MAX) || 
+                ((proximityCounter > 1) && (distance <= (motor_getStoppingDistance(motionVelocity, proximityUp) + (motionVelocity / 2))))) 
+            {
+                // learn from where the desk comes to rest, unless the 
+                // motors did not get there in time or the move was halted
+                tuningPending = ((proximityCounter <= DESK_SLOW_CYCLES_MAX) && (retargetHalted == false));
+                tuningUp = proximityUp;
+                tuningTarget = desk.target_position;
+                
+                position = motor[UNIT_LEFT].position;
+                cmd_instruction = MOTOR_CMD_MOVE_STOP;
                 desk.op_mode = OPERATION_MOVING_STOP;
             }
+            
+            cmd_position_hi = (uint8_t) ((position & 0xFF00) >> 8);
+            cmd_position_lo = (uint8_t) (position & 0xFF);
+        }
+        
+        else if (desk.op_mode == OPERATION_MOVING_FINE)
+        {
+            distance = motor_getRemainingDistance(proximityUp);
+            
+            if (fineBurst == true)
+            {
+                position = desk.target_position;
+                cmd_instruction = MOTOR_CMD_MOVE_SLOW;
+                
+                proximityCounter++;
+                velocity = MAX(motionVelocity, DESK_SLOW_VELOCITY);
+                
+                // the same rule as the end of a regular move. the motors 
+                // are at slow speed long before the measurement shows it, 
+                // the burst is at least the cycle of the first MOVE_SLOW.
+                if ((distance == 0) || (proximityCounter > DESK_SLOW_CYCLES_MAX) || 
+                    ((proximityCounter > 1) && (distance <= (motor_getStoppingDistance(velocity, proximityUp) + (velocity / 2))))) 
+                {
+                    position = motor[UNIT_LEFT].position;
+                    cmd_instruction = MOTOR_CMD_MOVE_STOP;
+                    fineBurst = false;
+                }
+            }
+            else
+            {
+                position = motor[UNIT_LEFT].position;
+                cmd_instruction = MOTOR_CMD_MOVE_STOP;
+                
+                // check the motor positions once the desk rests, a burst 
+                // which fell short or went past gets another one
+                if (motor_isResting() == true)
+                {
+                    if (desk.target_position > desk.current_position) {
+                        distance = (desk.target_position - desk.current_position);
+                    } else {
+                        distance = (desk.current_position - desk.target_position);
+                    }
+                    
+                    if (retargetPending == true) {
+                        desk.op_mode = OPERATION_MOVING_STOP;
+                    } else if ((distance <= DESK_FINE_TOLERANCE) || (finePulses >= DESK_FINE_PULSES_MAX)) {
+                        desk.target_position = desk.current_position;
+                        desk.op_mode = OPERATION_NORMAL;
+                    } else {
+                        desk.op_mode = OPERATION_ANNOUNCING;
+                    }
+                }
+            }
+            
+            cmd_position_hi = (uint8_t) ((position & 0xFF00) >> 8);
+            cmd_position_lo = (uint8_t) (position & 0xFF);
         }
         
         else if (desk.op_mode == OPERATION_MOVING_STOP)
@@ -563,8 +1118,34 @@ static void motor_controller(uint8_t *command)
             cmd_position_lo = (uint8_t) (motor[UNIT_LEFT].position & 0xFF);
             cmd_instruction = MOTOR_CMD_MOVE_STOP;
             
-            desk.target_position = desk.current_position;            
-            desk.op_mode = OPERATION_NORMAL;
+            // the desk coasts after the stop. it is handed over once it rests, 
+            // the travel until then would otherwise count as a new move.
+            if ((motor_isResting() == true) && (retargetPending == false))
+            {
+                // a route goes on from here, see waypoint_advance()
+                desk.target_position = desk.current_position;            
+                desk.op_mode = OPERATION_NORMAL;
+            }
+            else if (motor_isResting() == true)
+            {
+                // a target which came in while moving, the desk rests now
+                retargetPending = false;
+                finePulses = 0;
+                
+                if (retargetPosition > desk.current_position) {
+                    distance = (retargetPosition - desk.current_position);
+                } else {
+                    distance = (desk.current_position - retargetPosition);
+                }
+                
+                if (distance > DESK_FINE_DISTANCE_MIN) {
+                    desk.target_position = retargetPosition;
+                    desk.op_mode = OPERATION_ANNOUNCING;
+                } else {
+                    desk.target_position = desk.current_position;
+                    desk.op_mode = OPERATION_NORMAL;
+                }
+            }
         }
         
         else if (desk.op_mode == OPERATION_CALIBRATING)
@@ -592,24 +1173,37 @@ static void motor_controller(uint8_t *command)
         
         else if (desk.op_mode == OPERATION_NORMAL)
         {
+            if ((tuningDirty == true) && (tuningPending == false)) {
+                tuning_store();
+            }
+            
             if (desk.calibrate == true) {
                 desk.op_mode = OPERATION_ANNOUNCING;
             }
             // double check if the desk should be moved 
-            else if (desk.target_position != desk.current_position)
+            else if (targetRequested == true)
             {
+                targetRequested = false;
+                
                 if (desk.target_position > desk.current_position) {
                     distance = (desk.target_position - desk.current_position);
                 } else {
                     distance = (desk.current_position - desk.target_position);
                 }
                 
-                if (distance > DESK_STOPPING_DISTANCE) {
+                if (distance > DESK_FINE_DISTANCE_MIN) {
+                    finePulses = 0;
                     desk.op_mode = OPERATION_ANNOUNCING;
                 } else {
                     desk.target_position = desk.current_position;
                 }
             }
+            else
+            {
+                // only the host starts a move from here. the desk settling 
+                // after a calibration or a rescue is not one.
+                desk.target_position = desk.current_position;
+            }
                        
             cmd_position_hi = (uint8_t) ((desk.current_position & 0xFF00) >> 8);
             cmd_position_lo = (uint8_t) (desk.current_position & 0xFF);
@@ -617,8 +1211,29 @@ static void motor_controller(uint8_t *command)
             cmd_instruction = MOTOR_CMD_IDLE;
         }
         
+        else if (desk.op_mode == OPERATION_DWELLING)
+        {
+            if ((tuningDirty == true) && (tuningPending == false)) {
+                tuning_store();
+            }
+            
+            cmd_position_hi = (uint8_t) ((desk.current_position & 0xFF00) >> 8);
+            cmd_position_lo = (uint8_t) (desk.current_position & 0xFF);
+            cmd_instruction = MOTOR_CMD_IDLE;
+            
+            waypointDwell--;
+            
+            if (waypointDwell == 0) {
+                desk.op_mode = OPERATION_NORMAL;
+            }
+        }
+        
         else if (desk.op_mode == OPERATION_RESCUE) 
         {
+            tuningPending = false;
+            retargetPending = false;
+            waypoint_clear();
+            
             if (rescueCounter < 3)
             {
                 cmd_position_hi = (uint8_t) ((motor[UNIT_LEFT].position & 0xFF00) >> 8);
@@ -674,6 +1289,20 @@ static void motor_controller(uint8_t *command)
             
             rescueCounter++;
         }
+        
+        else
+        {
+            // OPERATION_LIMIT_UP and OPERATION_LIMIT_DOWN are not implemented, 
+            // a state without a branch keeps the stop from above
+        }
+        
+        // the next waypoint follows in the cycle the desk came to rest at 
+        // the last one, the host does not see OPERATION_NORMAL in between
+        if ((desk.op_mode == OPERATION_NORMAL) && (desk.calibrate == false) && 
+            (motor_isResting() == true) && (desk.target_position == desk.current_position)) 
+        {
+            waypoint_advance();
+        }
 
         command[0] = cmd_position_lo;
         command[1] = cmd_position_hi;
@@ -681,9 +1310,141 @@ static void motor_controller(uint8_t *command)
     }
 }
 
+static uint16_t motor_getStoppingDistance(uint8_t velocity, bool up)
+{
+    int16_t distance;
+    
+    // the left motor was sampled a while before the command goes out. it 
+    // keeps its speed until then and brakes with a constant deceleration.
+    distance = (int16_t) ((((uint16_t) velocity * schedule_table[schedule_active].latency) / DESK_CYCLE_TICKS) + 
+                          (((uint16_t) velocity * velocity) / (2 * DESK_BRAKE_DECELERATION)));
+    
+    // a load on the desk brakes one direction and pushes the other
+    distance += tuning.correction[(up == true) ? DESK_DIRECTION_UP : DESK_DIRECTION_DOWN];
+    
+    return (uint16_t) MAX(distance, 0);
+}
+
+static bool motor_isResting()
+{
+    // a single sample without travel may be a response which got lost
+    return (motionRest >= DESK_REST_SAMPLES);
+}
+
+static uint16_t motor_getRemainingDistance(bool up)
+{
+    uint16_t position, travel;
+    
+    // distance ahead of the desk to the target, 0 once it is passed. after a 
+    // lost sample the desk went on at the held speed since the last one.
+    travel = (uint16_t) MIN((((uint32_t) motionVelocity * motionStale) / DESK_CYCLE_TICKS), 0xFFFF);
+    
+    if (up == true) {
+        position = desk.current_position + travel;
+        return (desk.target_position > position) ? (desk.target_position - position) : 0;
+    }
+    
+    position = (desk.current_position > travel) ? (desk.current_position - travel) : 0;
+    return (position > desk.target_position) ? (position - desk.target_position) : 0;
+}
+
+static uint16_t motor_getHaltDistance(bool up)
+{
+    // one more cycle at the measured speed, then a slow approach and the stop
+    return (motor_getStoppingDistance(motionVelocity, up) + motionVelocity + DESK_SLOW_APPROACH);
+}
+
+static uint16_t motor_getHaltPosition(bool up)
+{
+    uint16_t distance = motor_getHaltDistance(up);
+    
+    // the closest position the desk can still come to rest at
+    if (up == true) {
+        return MIN((desk.current_position + distance), desk.upper_limit);
+    } else {
+        return ((desk.current_position > (desk.lower_limit + distance)) ? (desk.current_position - distance) : desk.lower_limit);
+    }
+}
+
+/*******************
+ * 
+ * S T O P P I N G   C O R R E C T I O N
+ * 
+ ******************/
+static void tuning_load()
+{
+    uint8_t i, *data = (uint8_t *) &tuning;
+    
+    for (i=0; i<sizeof(tuning); i++) {
+        data[i] = nvm_read(NVM_ADDR_DESK_TUNING + i);
+    }
+    
+    if ((tuning.magic != DESK_TUNING_MAGIC) || 
+        (tuning.checksum != desk_checksum(data, (sizeof(tuning) - 1))))
+    {
+        // nothing learned yet, start with the plain model
+        tuning.magic = DESK_TUNING_MAGIC;
+        
+        for (i=0; i<DESK_DIRECTION_MAX; i++) {
+            tuning.correction[i] = 0;
+        }
+        
+        tuning.checksum = desk_checksum(data, (sizeof(tuning) - 1));
+    }
+}
+
+static void tuning_update()
+{
+    int16_t error, correction;
+    uint8_t direction = (tuningUp == true) ? DESK_DIRECTION_UP : DESK_DIRECTION_DOWN;
+    
+    // positive if the desk came to rest beyond the target
+    if (tuningUp == true) {
+        error = (int16_t) (desk.current_position - tuningTarget);
+    } else {
+        error = (int16_t) (tuningTarget - desk.current_position);
+    }
+    
+    // a heavy load leaves the desk far off before anything was learned. 
+    // the correction approaches it over a few moves instead of ignoring it.
+    error = MIN(MAX(error, -DESK_TUNING_ERROR_MAX), DESK_TUNING_ERROR_MAX);
+    
+    // small errors are noise and leave the eeprom alone
+    correction = tuning.correction[direction] + (error / DESK_TUNING_GAIN);
+    correction = MIN(MAX(correction, -DESK_TUNING_LIMIT), DESK_TUNING_LIMIT);
+    
+    if (correction != tuning.correction[direction])
+    {
+        tuning.correction[direction] = (int8_t) correction;
+        tuning.checksum = desk_checksum((uint8_t *) &tuning, (sizeof(tuning) - 1));
+        tuningDirty = true;
+    }
+}
+
+static void tuning_store()
+{
+    uint8_t i, *data = (uint8_t *) &tuning;
+    
+    // a byte per cycle, the motor command must not wait for the eeprom. 
+    // the checksum goes last, an interrupted update is discarded on load.
+    if (nvm_isBusy() == true) {
+        return;
+    }
+    
+    for (i=0; i<sizeof(tuning); i++) 
+    {
+        if (nvm_read(NVM_ADDR_DESK_TUNING + i) != data[i]) {
+            nvm_write((NVM_ADDR_DESK_TUNING + i), data[i]);
+            return;
+        }
+    }
+    
+    tuningDirty = false;
+}
+
 static uint16_t motor_getLowerPosition()
 {
-    uint16_t position;
+    uint16_t position = desk.current_position;
     
     if ((motor[UNIT_LEFT].outage_count == 0) && (motor[UNIT_RIGHT].outage_count == 0))
     {
@@ -701,7 +1462,8 @@ static uint16_t motor_getLowerPosition()
     } 
     else 
     {
-        // we got a problem. both motors did not send valid data
+        // we got a problem. both motors did not send valid data, stay 
+        // with the last position of the left one
     } 
     
     return position;
@@ -709,7 +1471,7 @@ static uint16_t motor_getLowerPosition()
 
 static uint16_t motor_getHigherPosition()
 {
-    uint16_t position;
+    uint16_t position = desk.current_position;
     
     if ((motor[UNIT_LEFT].outage_count == 0) && (motor[UNIT_RIGHT].outage_count == 0))
     {
@@ -727,34 +1489,116 @@ static uint16_t motor_getHigherPosition()
     } 
     else 
     {
-        // we got a problem. both motors did not send valid data
+        // we got a problem. both motors did not send valid data, stay 
+        // with the last position of the left one
     } 
     
     return position;
 }
 
 
+/*******************
+ * 
+ * W A Y P O I N T S
+ * 
+ ******************/
+static void waypoint_clear()
+{
+    waypointHead = 0;
+    waypointCount = 0;
+    waypointDwell = 0;
+}
+
+static void waypoint_advance()
+{
+    uint16_t distance;
+    struct desk_waypoint *entry;
+    
+    // the dwell of the waypoint the desk just reached
+    if (waypointDwell > 0) {
+        desk.op_mode = OPERATION_DWELLING;
+        return;
+    }
+    
+    while (waypointCount > 0)
+    {
+        entry = &waypoint[waypointHead];
+        waypointHead = ((waypointHead + 1) & (DESK_WAYPOINTS - 1));
+        waypointCount--;
+        waypointDwell = entry->dwell;
+        
+        if (entry->position > desk.current_position) {
+            distance = (entry->position - desk.current_position);
+        } else {
+            distance = (desk.current_position - entry->position);
+        }
+        
+        // a waypoint the desk already rests at only adds its dwell
+        if (distance > DESK_FINE_DISTANCE_MIN) {
+            finePulses = 0;
+            desk.target_position = entry->position;
+            desk.op_mode = OPERATION_ANNOUNCING;
+            return;
+        } else if (waypointDwell > 0) {
+            desk.op_mode = OPERATION_DWELLING;
+            return;
+        }
+    }
+}
+
+
 /*******************
  * 
  * S T A R T U P   R O U T I N E S
  * 
  ******************/
-static void startup_announcement()
+static bool startup_loadCache()
 {
-    const uint8_t announcement[LIN_DIAG_PACKET_LEN] = {0xFF, 0x07, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    uint8_t i, *data = (uint8_t *) &startup_cache;
     
-    lin_write(LIN_NODE_DIAG_TX, announcement, 8);
+    for (i=0; i<sizeof(startup_cache); i++) {
+        data[i] = nvm_read(NVM_ADDR_DESK_CACHE + i);
+    }
+    
+    return ((startup_cache.magic == DESK_CACHE_MAGIC) && 
+            (startup_cache.count > 0) && (startup_cache.count <= UNIT_MAX) && 
+            (startup_cache.checksum == desk_checksum(data, (sizeof(startup_cache) - 1))));
 }
 
-static void startup_preprocessing(uint8_t step)
+static void startup_storeCache()
 {
-    const uint8_t message01[LIN_DIAG_PACKET_LEN] = {0xFF, 0x01, 0x07, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-    const uint8_t message02[LIN_DIAG_PACKET_LEN] = {0xD0, 0x02, 0x07, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    uint8_t i, *data = (uint8_t *) &startup_cache;
+    
+    startup_cache.magic = DESK_CACHE_MAGIC;
+    startup_cache.count = MIN((startup_nodeIdentifier + 1), UNIT_MAX);
+    
+    for (i=0; i<UNIT_MAX; i++) {
+        startup_cache.node[i] = node[i];
+    }
+    
+    // the checksum itself is the last byte
+    startup_cache.checksum = desk_checksum(data, (sizeof(startup_cache) - 1));
     
+    // only write what has changed, most boots do not write at all
+    for (i=0; i<sizeof(startup_cache); i++) 
+    {
+        if (nvm_read(NVM_ADDR_DESK_CACHE + i) != data[i]) {
+            nvm_write((NVM_ADDR_DESK_CACHE + i), data[i]);
+        }
+    }
+}
+
+static void startup_announcement()
+{
+    lin_writeFrame(&frame_announcement);
+}
+
+static void startup_preprocessing(uint8_t step)
+{
     switch (step)
     {
-        case 1: lin_write(LIN_NODE_DIAG_TX, message01, 8); break;
-        case 2: lin_write(LIN_NODE_DIAG_TX, message02, 8); break;
+        case 1: lin_writeFrame(&frame_preprocessing[0]); break;
+        case 2: lin_writeFrame(&frame_preprocessing[1]); break;
         default: break;
     }
 }
@@ -823,10 +1667,11 @@ static void startup_writeIdentifier(uint8_t node)
 
 static void startup_setCycle()
 {
-    uint8_t i, rx_len, rx_data[10];
+    uint8_t i, rx_len = 0, *rx_data = NULL;
     
+    // nothing was received yet when the startup begins
     if (desk.op_mode > STARTUP_BEGIN) {
-        rx_len = lin_getRxData(rx_data);
+        rx_len = lin_getRxData(&rx_data);
     }
     
     if (desk.op_mode == STARTUP_BEGIN) {
@@ -848,6 +1693,12 @@ static void startup_setCycle()
         startup_nodeIdentifier = 0x07;
         startup_nodeFound = 0xFF;
         desk.op_mode = STARTUP_SCAN_NODE;
+        
+        if (startup_cached == true) {
+            // the nodes are known from last time. probe them directly.
+            startup_cacheIndex = 0;
+            startup_nodeCounter = startup_cache.node[0].node_id;
+        }
     }
     else if (desk.op_mode == STARTUP_SCAN_NODE) {
         if (rx_len > 0) {
@@ -862,6 +1713,12 @@ static void startup_setCycle()
             
             desk.op_mode = STARTUP_READ_STATUS_BYTE;
         }
+        else if (startup_cached == true)
+        {
+            // cached node is gone. start over with a full scan.
+            startup_cached = false;
+            desk.op_mode = STARTUP_BEGIN;
+        }
         else 
         {
             // no node responded. so try next ID and stay within same cycle.
@@ -879,13 +1736,21 @@ static void startup_setCycle()
                 node[startup_nodeIdentifier].node_id = startup_nodeCounter;
                 startup_retryCounter = 0;
                 desk.op_mode = STARTUP_READ_UPPER_LIMIT_HI;
+                
+                if (startup_cached == true)
+                {
+                    if (startup_cache.node[startup_cacheIndex].property == rx_data[1]) {
+                        // same node as last time, the limits are known
+                        node[startup_nodeIdentifier] = startup_cache.node[startup_cacheIndex];
+                        desk.op_mode = STARTUP_WRITE_IDENTIFIER;
+                    } else {
+                        startup_cached = false;
+                        desk.op_mode = STARTUP_BEGIN;
+                    }
+                }
             }
         } else {
-            startup_retryCounter++; 
-            
-            if (startup_retryCounter > STARTUP_READ_RETRY) {
-                desk.op_mode = STARTUP_BEGIN;
-            }
+            startup_retry();
         }
     }
     else if (desk.op_mode == STARTUP_READ_UPPER_LIMIT_HI) {
@@ -896,11 +1761,7 @@ static void startup_setCycle()
                 desk.op_mode = STARTUP_READ_UPPER_LIMIT_LO;
             }
         } else {
-            startup_retryCounter++; 
-            
-            if (startup_retryCounter > STARTUP_READ_RETRY) {
-                desk.op_mode = STARTUP_BEGIN;
-            }
+            startup_retry();
         }
     }
     else if (desk.op_mode == STARTUP_READ_UPPER_LIMIT_LO) {
@@ -911,11 +1772,7 @@ static void startup_setCycle()
                 desk.op_mode = STARTUP_READ_LOWER_LIMIT_HI;
             }
         } else {
-            startup_retryCounter++; 
-            
-            if (startup_retryCounter > STARTUP_READ_RETRY) {
-                desk.op_mode = STARTUP_BEGIN;
-            }
+            startup_retry();
         }
     }
     else if (desk.op_mode == STARTUP_READ_LOWER_LIMIT_HI) {
@@ -926,11 +1783,7 @@ static void startup_setCycle()
                 desk.op_mode = STARTUP_READ_LOWER_LIMIT_LO;
             }
         } else {
-            startup_retryCounter++; 
-            
-            if (startup_retryCounter > STARTUP_READ_RETRY) {
-                desk.op_mode = STARTUP_BEGIN;
-            }
+            startup_retry();
         }
     }
     else if (desk.op_mode == STARTUP_READ_LOWER_LIMIT_LO) {
@@ -941,11 +1794,7 @@ static void startup_setCycle()
                 desk.op_mode = STARTUP_WRITE_IDENTIFIER;
             }
         } else {
-            startup_retryCounter++; 
-            
-            if (startup_retryCounter > STARTUP_READ_RETRY) {
-                desk.op_mode = STARTUP_BEGIN;
-            }
+            startup_retry();
         }
     }
     else if (desk.op_mode == STARTUP_WRITE_IDENTIFIER) {
@@ -954,13 +1803,25 @@ static void startup_setCycle()
                 startup_nodeCounter++;
                 startup_retryCounter = 0;
                 desk.op_mode = STARTUP_SCAN_NODE;
+                
+                if (startup_cached == true)
+                {
+                    startup_cacheIndex++;
+                    
+                    if (startup_cacheIndex < startup_cache.count) {
+                        startup_nodeCounter = startup_cache.node[startup_cacheIndex].node_id;
+                    } else {
+                        desk.op_mode = STARTUP_POSTPROCESSING_ONE;
+                    }
+                }
+                else if ((startup_quickScan == true) && (startup_nodeIdentifier >= (UNIT_MAX - 1)))
+                {
+                    // all motors are identified, the remaining node counters stay silent anyway
+                    desk.op_mode = STARTUP_POSTPROCESSING_ONE;
+                }
             }
         } else {
-            startup_retryCounter++; 
-            
-            if (startup_retryCounter > STARTUP_READ_RETRY) {
-                desk.op_mode = STARTUP_BEGIN;
-            }
+            startup_retry();
         }
     }        
     else if (desk.op_mode == STARTUP_POSTPROCESSING_ONE) {
@@ -997,7 +1858,12 @@ static void startup_setCycle()
                 desk.upper_limit = motor[UNIT_LEFT].upper_limit;
             } 
             
+            if (startup_cached == false) {
+                startup_storeCache();
+            }
+            
             desk.op_mode = OPERATION_BEGIN;
+            desk_retain();
         }
     }
     else {
@@ -1005,3 +1871,59 @@ static void startup_setCycle()
     }
 }
 
+static void startup_retry()
+{
+    uint8_t retries = STARTUP_READ_RETRY;
+    
+    // the state is kept, so the same request is sent again with the next 
+    // cycle. the quick scan insists on it, instead of starting all over. 
+    if (startup_quickScan == true) {
+        retries = STARTUP_QUICK_RETRY;
+    }
+    
+    startup_retryCounter++;
+    
+    if (startup_retryCounter > retries) {
+        startup_retryCounter = 0;
+        desk.op_mode = STARTUP_BEGIN;
+    }
+}
+
+
+/**********************************************************
+ * CALLBACK FUNCTIONS
+ *********************************************************/
+static void desk_advanceTick(bool write)
+{
+    // the frame finished before the end of its slot. move the next tick 
+    // forward, so the next slot starts after the inter-frame space. the 
+    // regular tick remains as timeout for frames which do not complete. 
+    uint8_t counter = (TMR0_PeriodGet() - DESK_INTERFRAME_SPACE);
+    
+    if (write == true) {
+        // writes complete when the checksum was moved to the shift register
+        counter -= DESK_TX_TAIL;
+    }
+    
+    if (TMR0_CounterGet() < counter) {
+        TMR0_CounterSet(counter);
+    }
+}
+
+static void cb_desk_frameComplete()
+{
+    if ((desk.op_mode & STARTUP) == STARTUP)
+    {
+        // a retry gives the node the full fixed spacing
+        if ((startup_adaptive == true) && (startup_retryCounter == 0)) {
+            startup_frameDone = true;
+            desk_advanceTick(startup_readback);     // the readback follows a write
+        }
+    }
+    else if ((desk.op_mode & OPERATION) == OPERATION)
+    {
+        if ((schedule_eventDriven == true) && (timekeeper == 0)) {
+            desk_advanceTick(schedule_readSlot == NULL);
+        }
+    }
+}
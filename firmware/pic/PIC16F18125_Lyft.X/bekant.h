@@ -53,8 +53,40 @@
 #define DESK_ADDR_MASTER            18			/**< LIN node ID 18 (Master) */
 
 #define STARTUP_READ_RETRY          2
+#define STARTUP_QUICK_RETRY         8           /**< retries of a single register read before the quick scan starts over */
+#ifndef STARTUP_QUICK_SCAN_DEFAULT
+#define STARTUP_QUICK_SCAN_DEFAULT  true        /**< the scan stops after the last motor, false = all node counters */
+#endif
+#ifndef STARTUP_ADAPTIVE_DEFAULT
+#define STARTUP_ADAPTIVE_DEFAULT    true        /**< startup steps follow the completed frame, false = the 5ms tick */
+#endif
+#define DESK_CACHE_MAGIC            0xB4        /**< marks a valid node discovery cache in eeprom */
+#define DESK_RETAIN_MAGIC           0x5A        /**< marks a valid copy of the desk state in persistent ram */
+#define DESK_TUNING_MAGIC           0xC7        /**< marks valid stopping corrections in eeprom */
 #define DESK_PACKET_LEN             3           /**< every data packet in operation mode has a net data length of 3 bytes (without checksum) */
-#define DESK_STOPPING_DISTANCE      140
+#define DESK_STOPPING_DISTANCE      140         /**< shortest move at full speed, and the distance left when a move is halted */
+#define DESK_CYCLE_TICKS            20          /**< TMR0 ticks of a lin cycle, the same for all schedules */
+#define DESK_BRAKE_DECELERATION     22          /**< position units per cycle^2 the motors lose after MOVE_SLOW or MOVE_STOP */
+#define DESK_SLOW_APPROACH          8           /**< least distance left for MOVE_SLOW once the desk has slowed down */
+#define DESK_SLOW_CYCLES_MAX        30          /**< the motors are stopped after that many cycles of MOVE_SLOW */
+#define DESK_SLOW_VELOCITY          9           /**< position units per cycle at MOVE_SLOW */
+#define DESK_REST_SAMPLES           2           /**< fresh samples in a row without travel before the desk counts as resting */
+#define DESK_FINE_DISTANCE_MIN      8           /**< shortest move, about the travel of a single cycle of MOVE_SLOW */
+#define DESK_FINE_TOLERANCE         4           /**< a fine move is done once the desk rests that close to the target */
+#define DESK_FINE_PULSES_MAX        3           /**< MOVE_SLOW bursts of a fine move, including corrections */
+#define DESK_TUNING_GAIN            8           /**< the correction takes up an eighth of the resting error of a move */
+#define DESK_TUNING_LIMIT           120         /**< largest correction of the stopping distance either way, kept in an int8_t */
+#define DESK_TUNING_ERROR_MAX       120         /**< a move which rests further off is learned from as if it rested that far off */
+#define DESK_WAYPOINTS              4           /**< targets queued by the host, has to be a power of two */
+#ifndef DESK_SCHEDULE_DEFAULT
+#define DESK_SCHEDULE_DEFAULT       DESK_SCHEDULE_LEAN      /**< DESK_SCHEDULE_CLASSIC = the bus traffic of the bekant controller */
+#endif
+#ifndef DESK_EVENT_DRIVEN_DEFAULT
+#define DESK_EVENT_DRIVEN_DEFAULT   true        /**< the next slot starts once a frame completed, false = the 5ms tick */
+#endif
+#define DESK_INTERFRAME_SPACE       16          /**< TMR0 counts (~0.5ms) between the end of a frame and the next slot */
+#define DESK_TX_TAIL                16          /**< TMR0 counts to shift out the checksum after the last tx interrupt */
+#define DESK_BUS_ERRORS             5           /**< error counters per lin frame id, in the order of enum lin_error */
 
 #define MOTOR_CMD_IDLE				0xFC		/**< Motor command idle */
 #define MOTOR_CMD_ANNOUNCEMENT		0xC4		/**< Motor command to announce a moving command */
@@ -110,7 +142,28 @@ enum desk_state {       // desk_mode, desk_operation
     OPERATION_CALIBRATING       = 0x49,
     OPERATION_CALIBRATING_DONE  = 0x4A,
     OPERATION_LIMIT_UP          = 0x4B,     // not implemented
-    OPERATION_LIMIT_DOWN        = 0x4C      // not implemented
+    OPERATION_LIMIT_DOWN        = 0x4C,     // not implemented
+    OPERATION_MOVING_FINE       = 0x4D,
+    OPERATION_DWELLING          = 0x4E      // rests at a waypoint before the next one
+};
+
+enum desk_frame {
+    DESK_FRAME_IDLE,            /**< no bus traffic, host requests are processed */
+    DESK_FRAME_WRITE,           /**< master publishes DESK_PACKET_LEN bytes, built by the handler */
+    DESK_FRAME_READ,            /**< header only, the handler gets the response in the next slot */
+    DESK_FRAME_CONST            /**< master publishes the constant frame of the slot */
+};
+
+enum desk_schedules {
+    DESK_SCHEDULE_CLASSIC,
+    DESK_SCHEDULE_LEAN,
+    DESK_SCHEDULE_MAX
+};
+
+enum desk_direction {
+    DESK_DIRECTION_UP,
+    DESK_DIRECTION_DOWN,
+    DESK_DIRECTION_MAX
 };
 
 enum motor_unit {
@@ -140,6 +193,39 @@ struct motor_instance {
     uint16_t    position;
 };
 
+struct desk_cache {
+    uint8_t     magic;
+    uint8_t     count;          /**< number of nodes found */
+    struct node_instance node[UNIT_MAX];
+    uint8_t     checksum;
+};
+
+struct desk_tuning {
+    uint8_t     magic;
+    int8_t      correction[DESK_DIRECTION_MAX];     /**< added to the stopping distance */
+    uint8_t     checksum;
+};
+
+struct desk_waypoint {
+    uint16_t    position;
+    uint16_t    dwell;          /**< lin cycles to rest there before the next waypoint */
+};
+
+struct desk_slot {
+    uint8_t     frame;
+    uint8_t     node_id;
+    uint8_t     length;         /**< data bytes written or expected as response, 0 = none */
+    void        (*handler)(uint8_t *data, uint8_t length);
+    uint8_t     ticks;          /**< slot length in TMR0 ticks (5ms) */
+    const struct lin_frame *message;    /**< DESK_FRAME_CONST only, checksum calculated at build time */
+};
+
+struct desk_schedule {
+    const struct desk_slot *slots;
+    uint8_t     length;
+    uint8_t     latency;        /**< TMR0 ticks from the sample of the left motor to the motor command */
+};
+
 struct desk_instance {
     bool        calibrate;
     uint8_t     op_mode;
@@ -149,10 +235,38 @@ struct desk_instance {
     uint16_t    current_position;
 };
 
+struct desk_snapshot {
+    uint8_t     sequence;
+    uint8_t     op_mode;
+    uint8_t     drift;
+    uint16_t    upper_limit;
+    uint16_t    lower_limit;
+    uint16_t    position;
+    struct motor_instance motor[UNIT_MAX];
+    uint8_t     waypoints;      /**< queued, not counting the one the desk moves to */
+};
+
+struct desk_retention {
+    uint8_t     magic;
+    struct desk_instance desk;
+    struct node_instance node[UNIT_MAX];
+    struct motor_instance motor[UNIT_MAX];
+    uint8_t     checksum;
+};
+
 
 void                desk_init(bool enable);
+bool                desk_resume();
 void                desk_startup();
 void                desk_operation();
+void                desk_setSchedule(uint8_t schedule);
+uint8_t             desk_getSchedule();
+void                desk_setEventDriven(bool enable);
+bool                desk_isEventDriven();
+void                desk_setQuickScan(bool enable);
+bool                desk_isQuickScan();
+void                desk_setAdaptiveStartup(bool enable);
+bool                desk_isAdaptiveStartup();
 
 bool                desk_isBusy();
 uint8_t             desk_getOpMode();
@@ -160,7 +274,15 @@ uint8_t             desk_getDrift();
 uint16_t            desk_getUpperLimit();
 uint16_t            desk_getLowerLimit();
 uint16_t            desk_getPosition();
+uint8_t             desk_getSequence();
+const struct desk_snapshot *desk_getSnapshot();
+void                desk_getBusErrors(uint8_t node_id, uint8_t *count);
+void                desk_clearBusErrors();
+uint16_t            desk_getStoppingDistance(bool up);
 void                desk_setPosition(uint16_t position);
+bool                desk_halt();
+uint8_t             desk_addWaypoint(uint16_t position, uint16_t dwell);
+uint8_t             desk_getWaypoints();
 void                desk_runCalibration();
 
 
@@ -171,11 +293,37 @@ uint8_t             motor_getProperty(uint8_t unit);
 uint16_t            motor_getPosition(uint8_t unit);
 uint16_t            motor_getUpperLimit(uint8_t unit);
 uint16_t            motor_getLowerLimit(uint8_t unit);
+uint8_t             motor_getOutageCount(uint8_t unit);
 
+static void         motor_update(uint8_t unit, uint8_t *data, uint8_t length);
+static void         motor_supervise();
 static void         motor_controller(uint8_t *command);  
+static uint16_t     motor_getStoppingDistance(uint8_t velocity, bool up);
+static bool         motor_isResting();
+static uint16_t     motor_getRemainingDistance(bool up);
+static uint16_t     motor_getHaltDistance(bool up);
+static uint16_t     motor_getHaltPosition(bool up);
 static uint16_t     motor_getLowerPosition();
 static uint16_t     motor_getHigherPosition();
 
+static void         tuning_load();
+static void         tuning_update();
+static void         tuning_store();
+
+static void         waypoint_clear();
+static void         waypoint_advance();
+
+
+static void         desk_publish();
+static void         desk_retain();
+static void         desk_discard();
+static uint8_t      desk_checksum(uint8_t *data, uint8_t length);
+
+
+static void         schedule_writeMotorCommand(uint8_t *data, uint8_t length);
+static void         schedule_readMotorLeft(uint8_t *data, uint8_t length);
+static void         schedule_readMotorRight(uint8_t *data, uint8_t length);
+
 
 static void         startup_announcement();
 static void         startup_preprocessing(uint8_t step);
@@ -188,6 +336,12 @@ static void         startup_readLowerLimitHi(uint8_t node);
 static void         startup_readLowerLimitLo(uint8_t node);
 static void         startup_writeIdentifier(uint8_t node);
 static void         startup_setCycle();
+static void         startup_retry();
+static bool         startup_loadCache();
+static void         startup_storeCache();
+
+static void         desk_advanceTick(bool write);
+static void         cb_desk_frameComplete();
 
 
 #endif	/* BEKANT_H */
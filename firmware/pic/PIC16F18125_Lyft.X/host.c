@@ -9,124 +9,303 @@
 #include "host.h"
 
 
-struct host_data_packet host_rx_packet, host_tx_packet;
-enum host_transmission host_rx_state;
-enum host_transmission host_tx_state;
+static struct host_data_packet host_rx_queue[HOST_RX_QUEUE_LEN];
+static struct host_data_packet host_tx_queue[HOST_TX_QUEUE_LEN];
+static enum host_transmission host_rx_state;
+static volatile enum host_transmission host_tx_state;   // checked by host_send() against the isr
 
-bool        newData;
-uint8_t     rx_byteCount;
-uint8_t     tx_byteCount;
+static volatile uint8_t rx_head;    // frames received, only written by the isr
+static uint8_t     rx_tail;         // frames answered, only written by host_release()
+static uint8_t     tx_head;         // frames queued, only written by host_send()
+static volatile uint8_t tx_tail;    // frames sent, only written by the isr
+static bool        rx_sequencePending;
+static bool        tx_sequencePending;
+static uint8_t     rx_byteCount;
+static uint8_t     rx_checksum;     // xor of the frame received so far, 0 for a valid frame
+static uint8_t     tx_byteCount;
+static uint8_t     request_stx;     // framing of the request being answered
+static uint8_t     request_sequence;
+static uint8_t     request_command;
+
+// BRG16 = 1, BRGH = 1: baud = FOSC / (4 * (SP2BRG + 1)). the inter-byte timeout 
+// of TMR2 (31kHz) is scaled to about 23 byte times at every rate.
+static const uint8_t baud_brg[BAUD_MAX] = { 0x44, 0x1F, 0x0F, 0x07 };
+static const uint8_t baud_timeout[BAUD_MAX] = { 0x3D, 0x1C, 0x0E, 0x07 };
+
+static uint8_t     baud_current;
+static uint8_t     baud_pending;    // applied after the acknowledge was sent
+static volatile uint8_t baud_confirm;   // TMR2 periods left for the host to confirm, 0 = confirmed
 
 
 void host_init()
 {    
     UART2.RxCompleteCallbackRegister(&cb_host_rx);
     UART2.TxCompleteCallbackRegister(&cb_host_tx);
+    UART2.FramingErrorCallbackRegister(&cb_host_ferr);
     
     TMR2_OverflowCallbackRegister(&cb_tmr2);
     
-    newData = false;
+    rx_head = 0;
+    rx_tail = 0;
+    tx_head = 0;
+    tx_tail = 0;
+    request_stx = HOST_STX;
+    request_sequence = 0;
+    request_command = 0;
+    baud_current = BAUD_115200;     // set by SYSTEM_Initialize()
+    baud_pending = BAUD_115200;
+    baud_confirm = 0;
     host_rx_state = READY;
     host_tx_state = READY;       
 }
 
 bool host_newDataAvailable()
 {
-    return newData;
+    return (rx_head != rx_tail);
+}
+
+uint8_t host_peekCommand()
+{
+    // a queued packet is not touched by the isr until it was read
+    return host_rx_queue[rx_tail & (HOST_RX_QUEUE_LEN - 1)].command;
 }
 
-void host_read(struct host_data_packet *packet)
+const struct host_data_packet *host_read()
 {
-    if (packet != NULL)
+    const struct host_data_packet *packet;
+    
+    if (rx_head == rx_tail) {
+        return NULL;
+    }
+    
+    // the slot is not touched by the isr until host_release() was called
+    packet = &host_rx_queue[rx_tail & (HOST_RX_QUEUE_LEN - 1)];
+
+    request_stx = packet->stx;
+    request_sequence = packet->sequence;
+    request_command = packet->command;
+
+    if (baud_confirm > 0)
     {
-        *packet = host_rx_packet;
-        host_rx_state = READY;
-        newData = false;
+        // the first request at the new rate confirms it, a corrupted one falls back
+        INTERRUPT_GlobalInterruptDisable();
+
+        if (packet->isValid == true) {
+            baud_confirm = 0;
+            TMR2_PeriodSet(baud_timeout[baud_current]);
+        } else {
+            host_applyBaudrate(BAUD_115200);
+        }
+
+        INTERRUPT_GlobalInterruptEnable();
+    }
+    
+    return packet;
+}
+
+void host_release()
+{
+    if (rx_head != rx_tail) {
+        rx_tail++;
     }
 }
 
-void host_write(struct host_data_packet packet)
+struct host_data_packet *host_beginResponse()
 {
-    host_tx_packet = packet;
+    struct host_data_packet *packet;
     
-    tx_byteCount = 0;
-    host_tx_state = TRANSMITTING;    
-    UART2.Write(HOST_STX);     
+    // the response goes out with the framing of the last request read
+    packet = host_beginFrame(request_command | 0x80);
+    
+    if (packet != NULL) {
+        packet->stx = request_stx;
+        packet->sequence = request_sequence;
+    }
+    
+    return packet;
 }
 
-void host_calcChecksum(struct host_data_packet *packet)
+struct host_data_packet *host_beginFrame(uint8_t command)
 {
-    uint8_t i, checksum = HOST_STX;
+    struct host_data_packet *packet;
     
-    if (packet != NULL)
-    {
-        checksum ^= packet->command;
-        checksum ^= packet->length;
+    // NULL if all slots are taken, see host_isWritable()
+    if ((uint8_t) (tx_head - tx_tail) >= HOST_TX_QUEUE_LEN) {
+        return NULL;
+    }
+    
+    // unsolicited frames always use the plain framing
+    packet = &host_tx_queue[tx_head & (HOST_TX_QUEUE_LEN - 1)];
+    packet->stx = HOST_STX;
+    packet->sequence = 0;
+    packet->command = command;
+    packet->length = 0;
+    
+    return packet;
+}
 
-        for (i=0; i<packet->length; i++) {
-            checksum ^= packet->data[i];
-        }
+void host_send(struct host_data_packet *packet)
+{
+    // only the slot handed out last can be sent. a frame which is not sent 
+    // is simply overwritten by the next one.
+    if (packet != &host_tx_queue[tx_head & (HOST_TX_QUEUE_LEN - 1)]) {
+        return;
+    }
+    
+    host_calcChecksum(packet);
+    tx_head++;
+    
+    // once idle, the isr does not run anymore. otherwise it picks up the frame 
+    // when the current one is complete.
+    if (host_tx_state != TRANSMITTING) {
+        host_startFrame();
+    }
+}
+
+bool host_isTransmitting()
+{
+    return (host_tx_state == TRANSMITTING);
+}
+
+bool host_isWritable()
+{
+    // nothing may be queued between the acknowledge and the baud rate switch
+    return (((uint8_t) (tx_head - tx_tail) < HOST_TX_QUEUE_LEN) && (baud_pending == baud_current));
+}
+
+void host_process()
+{
+    // the acknowledge has to leave the shift register before the rate is changed
+    if ((baud_pending != baud_current) && (host_tx_state != TRANSMITTING) && (UART2.IsTxDone() == true))
+    {
+        INTERRUPT_GlobalInterruptDisable();
+        host_applyBaudrate(baud_pending);
         
-        packet->checksum = checksum;
+        if (baud_current != BAUD_115200)
+        {
+            // TMR2 counts the confirmation window until the first request arrived
+            TMR2_PeriodSet(0xFF);
+            baud_confirm = HOST_BAUD_CONFIRM;
+            TMR2_Start();
+        }
         
+        INTERRUPT_GlobalInterruptEnable();
     }
 }
 
-bool host_verifyChecksum(struct host_data_packet packet)
+void host_setBaudrate(uint8_t baudrate)
 {
-    bool isValid;
-    uint8_t i, calc_checksum;
+    if (baudrate < BAUD_MAX) {
+        baud_pending = baudrate;
+    }
+}
+
+static void host_calcChecksum(struct host_data_packet *packet)
+{
+    uint8_t i, checksum;
     
-    calc_checksum = HOST_STX;
-    calc_checksum ^= packet.command;
-    calc_checksum ^= packet.length;
+    checksum = packet->stx;
     
-    for (i=0; i<packet.length; i++) {
-        calc_checksum ^= packet.data[i];
+    if (packet->stx == HOST_STX_SEQUENCED) {
+        checksum ^= packet->sequence;
     }
+    
+    checksum ^= packet->command;
+    checksum ^= packet->length;
 
-    if (calc_checksum == packet.checksum) {
-        isValid = true;
-    } else {
-        isValid = false;
+    for (i=0; i<packet->length; i++) {
+        checksum ^= packet->data[i];
     }
+
+    packet->checksum = checksum;
+}
+
+static void host_startFrame(void)
+{
+    struct host_data_packet *packet = &host_tx_queue[tx_tail & (HOST_TX_QUEUE_LEN - 1)];
     
-    return isValid;
+    tx_byteCount = 0;
+    tx_sequencePending = (packet->stx == HOST_STX_SEQUENCED);
+    host_tx_state = TRANSMITTING;    
+    UART2.Write(packet->stx);     
+}
+
+static void host_applyBaudrate(uint8_t baudrate)
+{
+    TMR2_Stop();
+    TMR2_CounterSet(0);
+    TMR2_PeriodSet(baud_timeout[baudrate]);
+    
+    SP2BRGH = 0x00;
+    SP2BRGL = baud_brg[baudrate];
+    
+    // a frame in progress is garbled by the switch
+    rx_byteCount = 0;
+    host_rx_state = READY;
+    
+    baud_current = baudrate;
+    baud_pending = baudrate;
+    baud_confirm = 0;
 }
 
 
 static void cb_host_rx()
 {
     uint8_t index, rx_byte;
+    struct host_data_packet *host_rx_packet;
     
     rx_byte = UART2.Read();    
+    host_rx_packet = &host_rx_queue[rx_head & (HOST_RX_QUEUE_LEN - 1)];
     
-    if ((host_rx_state == READY) && (rx_byte == HOST_STX))
+    if ((host_rx_state == READY) && ((rx_byte == HOST_STX) || (rx_byte == HOST_STX_SEQUENCED)))
     {
-        // a transmission was initiated        
-        host_rx_state = RECEIVING;
-        rx_byteCount = 0;
-        
-        TMR2_Start();
+        // a transmission was initiated. if all slots are taken, the frame is lost.
+        if ((uint8_t) (rx_head - rx_tail) < HOST_RX_QUEUE_LEN)
+        {
+            host_rx_state = RECEIVING;
+            rx_byteCount = 0;
+            rx_sequencePending = (rx_byte == HOST_STX_SEQUENCED);
+            rx_checksum = rx_byte;
+            host_rx_packet->stx = rx_byte;
+            host_rx_packet->sequence = 0;
+
+            TMR2_Start();
+        }
     } 
     
+    else if ((host_rx_state == RECEIVING) && (rx_sequencePending == true))
+    {
+        rx_checksum ^= rx_byte;
+        host_rx_packet->sequence = rx_byte;
+        rx_sequencePending = false;
+    }
+    
     else if (host_rx_state == RECEIVING)
     {
+        // the checksum byte cancels out the xor of a valid frame
+        rx_checksum ^= rx_byte;
+        
         if (rx_byteCount == 0) {
-            host_rx_packet.command = rx_byte;
+            host_rx_packet->command = rx_byte;
         }    
         
         else if (rx_byteCount == 1) {
-            host_rx_packet.length = rx_byte;
+            host_rx_packet->length = rx_byte;
+            
+            if (rx_byte > DATA_BUFFER_SIZE) {
+                // would not fit into the packet. the guard below discards it.
+                rx_byteCount = DATA_BUFFER_SIZE + 3;
+            }
         }
         
         else 
         {
-            if (host_rx_packet.length == 0) 
+            if (host_rx_packet->length == 0) 
             {
-                host_rx_packet.checksum = rx_byte;
-                host_rx_state = FINISHED;
-                newData = true;
+                host_rx_packet->checksum = rx_byte;
+                host_rx_packet->isValid = (rx_checksum == 0);
+                host_rx_state = READY;
+                rx_head++;
                 
                 TMR2_Stop();
                 TMR2_CounterSet(0);
@@ -136,29 +315,33 @@ static void cb_host_rx()
             {
                 index = rx_byteCount - 2;
                 
-                if (index == host_rx_packet.length) 
+                if (index == host_rx_packet->length) 
                 {
-                    host_rx_packet.checksum = rx_byte;
-                    host_rx_state = FINISHED;
-                    newData = true;
+                    host_rx_packet->checksum = rx_byte;
+                    host_rx_packet->isValid = (rx_checksum == 0);
+                    host_rx_state = READY;
+                    rx_head++;
 
                     TMR2_Stop();
                     TMR2_CounterSet(0);
                 }
                 else {
-                    host_rx_packet.data[index] = rx_byte;
+                    host_rx_packet->data[index] = rx_byte;
                 }
             }
         }
         
         rx_byteCount++;
         
-        if (rx_byteCount > 10) {
+        if (rx_byteCount > (DATA_BUFFER_SIZE + 3)) {
             // something went wrong. discard this received data. 
             host_rx_state = READY;
-            newData = false;
             TMR2_Stop();
             TMR2_CounterSet(0);
+            
+            if (baud_confirm > 0) {
+                host_applyBaudrate(BAUD_115200);
+            }
         }
     }    
 }
@@ -166,41 +349,56 @@ static void cb_host_rx()
 static void cb_host_tx(void)
 {
     uint8_t index;       
+    struct host_data_packet *host_tx_packet;
+    
+    host_tx_packet = &host_tx_queue[tx_tail & (HOST_TX_QUEUE_LEN - 1)];
     
-    if (tx_byteCount == (host_tx_packet.length + 3)) 
+    if (tx_sequencePending == true)
     {
-        // last byte was already transmitted. transmission is complete.
-        host_tx_state = READY;
+        UART2.Write(host_tx_packet->sequence);
+        tx_sequencePending = false;
+    }
+    
+    else if (tx_byteCount == (host_tx_packet->length + 3)) 
+    {
+        // last byte was already transmitted. continue with the next frame.
+        tx_tail++;
+        
+        if (tx_head != tx_tail) {
+            host_startFrame();
+        } else {
+            host_tx_state = READY;
+        }
     }
         
     else
     {
         if (tx_byteCount == 0)
         {
-            UART2.Write(host_tx_packet.command);
+            UART2.Write(host_tx_packet->command);
         }
 
         else if (tx_byteCount == 1)
         {
-            UART2.Write(host_tx_packet.length);
+            UART2.Write(host_tx_packet->length);
         }
 
         else if (tx_byteCount > 1)
         {
-            if (host_tx_packet.length == 0)
+            if (host_tx_packet->length == 0)
             {
-                UART2.Write(host_tx_packet.checksum);
+                UART2.Write(host_tx_packet->checksum);
             }
             else
             {
-                if (tx_byteCount == (host_tx_packet.length + 2))
+                if (tx_byteCount == (host_tx_packet->length + 2))
                 {
-                    UART2.Write(host_tx_packet.checksum);
+                    UART2.Write(host_tx_packet->checksum);
                 }
                 else
                 {
                     index = (tx_byteCount - 2);
-                    UART2.Write(host_tx_packet.data[index]);
+                    UART2.Write(host_tx_packet->data[index]);
                 }
             }
         }
@@ -209,9 +407,32 @@ static void cb_host_tx(void)
     }
 }
 
+static void cb_host_ferr(void)
+{
+    // the host talks at another rate, e.g. after it was reset
+    if (baud_current != BAUD_115200) {
+        host_applyBaudrate(BAUD_115200);
+    }
+}
+
 static void cb_tmr2()
 {
+    if (baud_confirm > 0)
+    {
+        // no valid request at the new rate yet. the window is longer than 
+        // the inter-byte timeout, a request in progress is not cut off.
+        baud_confirm--;
+        
+        if (baud_confirm == 0) {
+            host_applyBaudrate(BAUD_115200);
+        } else {
+            TMR2_Start();
+        }
+        
+        return;
+    }
+    
+    // drops the frame in progress, the queued ones are kept
     rx_byteCount = 0;
-    newData = false;
     host_rx_state = READY;    
 }
\ No newline at end of file
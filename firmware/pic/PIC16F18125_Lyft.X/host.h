@@ -34,16 +34,23 @@
 
 
 #define HOST_STX            0x4C    
-#define DATA_BUFFER_SIZE    8
+#define HOST_STX_SEQUENCED  0x53    /**< [STX] [SEQ] [CMD] [LEN] [DATA] [CC], the response echoes SEQ */
+#define DATA_BUFFER_SIZE    16
+#define HOST_RX_QUEUE_LEN   4       /**< requests in flight, has to be a power of two */
+#define HOST_TX_QUEUE_LEN   4       /**< frames waiting to be sent, has to be a power of two */
+#define HOST_BAUD_CONFIRM   12      /**< TMR2 periods of ~8ms to confirm a new baud rate */
 
-#define PROTOCOL_VERSION    1
+#define PROTOCOL_VERSION    8
 
 
 struct host_data_packet {
+    uint8_t                 stx;
+    uint8_t                 sequence;
     uint8_t                 command;
     uint8_t                 length;
     uint8_t                 data[DATA_BUFFER_SIZE];
     uint8_t                 checksum;
+    bool                    isValid;    /**< rx only, the checksum accumulated by the isr matched */
 };
 
 enum host_transmission {
@@ -60,6 +67,9 @@ enum host_commands {
     GET_DESK_POSITION           = 0x12,
     GET_DESK_UPPER_LIMIT        = 0x13,
     GET_DESK_LOWER_LIMIT        = 0x14,
+    GET_DESK_SNAPSHOT           = 0x15,
+    GET_DESK_BUS_ERRORS         = 0x16,
+    GET_DESK_WAYPOINTS          = 0x17,
     
     GET_MOTOR_LEFT_STATE        = 0x20,
     GET_MOTOR_LEFT_POSITION     = 0x21,
@@ -84,13 +94,33 @@ enum host_commands {
     
     SET_DESK_POSITION           = 0x50,
     SET_DESK_HALT               = 0x51,
+    SET_DESK_STREAM             = 0x52,
+    SET_DESK_WAYPOINT           = 0x54,     // 0x53 is HOST_STX_SEQUENCED
+    
+    PUSH_DESK_TELEMETRY         = 0x60,     // unsolicited, sent as 0xE0 like a response
     
     GET_PROTOCOL_VERSION        = 0x70,
     GET_FIRMWARE_VERSION        = 0x71,
     GET_BOARD_REVISION          = 0x72, 
     
     CALL_WATCHDOG_ENABLE        = 0x73,
-    CALL_WATCHDOG_DISABLE       = 0x74
+    CALL_WATCHDOG_DISABLE       = 0x74,
+    
+    SET_HOST_BAUDRATE           = 0x75
+};
+
+enum host_stream {
+    STREAM_OFF,
+    STREAM_CYCLE,       // push the telemetry after every lin cycle
+    STREAM_CHANGE       // push the telemetry only if it has changed
+};
+
+enum host_baudrate {
+    BAUD_115200,        // default after reset and fallback
+    BAUD_250000,
+    BAUD_500000,
+    BAUD_1000000,
+    BAUD_MAX
 };
 
 enum host_errorCodes {
@@ -106,20 +136,31 @@ enum host_errorCodes {
 
     E_DESK_MIN_DISTANCE,
     E_DESK_UPPER_LIMIT_REACHED,
-    E_DESK_LOWER_LIMIT_REACHED
+    E_DESK_LOWER_LIMIT_REACHED,
+    E_DESK_QUEUE_FULL
 };
 
 
 void host_init();
 bool host_newDataAvailable();
-void host_read(struct host_data_packet *packet);
-void host_write(struct host_data_packet packet);
-
-void host_calcChecksum(struct host_data_packet *packet);
-bool host_verifyChecksum(struct host_data_packet packet);
+uint8_t host_peekCommand();
+const struct host_data_packet *host_read();
+void host_release();
+struct host_data_packet *host_beginResponse();
+struct host_data_packet *host_beginFrame(uint8_t command);
+void host_send(struct host_data_packet *packet);
+bool host_isTransmitting();
+bool host_isWritable();
+void host_process();
+void host_setBaudrate(uint8_t baudrate);
+
+static void host_calcChecksum(struct host_data_packet *packet);
+static void host_startFrame(void);
+static void host_applyBaudrate(uint8_t baudrate);
 
 static void cb_host_rx(void);
 static void cb_host_tx(void);
+static void cb_host_ferr(void);
 static void cb_tmr2();
 
 
@@ -6,22 +6,76 @@
  */
 #include "lin.h"
 
-uint8_t rx_byteCount, tx_byteCount;
-uint8_t rx_node_pid;
-uint8_t rx_buffer[12];
-
-struct lin_packet tx_packet;
-enum lin_bus_state lin_state;
+static uint8_t rx_byteCount, tx_byteCount;
+static uint8_t rx_node_pid;
+static uint8_t rx_expected;
+static uint8_t rx_buffer[12];
+static uint16_t rx_checksum;    // sum of all bytes but the last one, accumulated by cb_lin_rx()
+static uint8_t rx_echoCount, rx_echoLength;     // own bytes read back, starting with the break
+#if (LIN_DIRECT_ISR == 0)
+static bool rx_framingError;    // reported by the driver right before cb_lin_rx()
+#endif
+
+static struct lin_packet tx_packet;
+static const uint8_t *tx_data;  // tx_packet.data or the payload of a constant frame
+static enum lin_bus_state lin_state;
+
+static void (*lin_frameCompleteCallback)(void);
+
+static struct lin_errors lin_errorTable[LIN_ERROR_NODES];
+static struct lin_errors lin_errorSpare;        // frame ids beyond the table
+static struct lin_errors *lin_errorNode;        // counters of the current frame
+
+#define LIN_COUNT_ERROR(error)  do { if (lin_errorNode->count[error] < 0xFF) { lin_errorNode->count[error]++; } } while (0)
+
+#if (LIN_DIRECT_ISR == 1)
+// the isr services the registers itself. TX1IE is set with every byte 
+// written and cleared once nothing is left to send.
+#define LIN_RX_BYTE()       (RC1REG)
+#define LIN_TX_BYTE(data)   do { TX1REG = (data); PIE4bits.TX1IE = 1; } while (0)
+#define LIN_TX_ACK()        (PIE4bits.TX1IE = 0)
+#define LIN_SEND_BREAK()    (TX1STAbits.SENDB = 1)
+#define LIN_RX_ENABLE()     (RC1STAbits.CREN = 1)
+#define LIN_RX_DISABLE()    (RC1STAbits.CREN = 0)
+#else
+#define LIN_RX_BYTE()       UART1.Read()
+#define LIN_TX_BYTE(data)   UART1.Write(data)
+#define LIN_TX_ACK()        ((void) 0)
+#define LIN_SEND_BREAK()    EUSART1_SendBreakControlEnable()
+#define LIN_RX_ENABLE()     EUSART1_ReceiveEnable()
+#define LIN_RX_DISABLE()    EUSART1_ReceiveDisable()
+#endif
+
+#define LIN_PID_ROW(id)     LIN_PID(id), LIN_PID(id + 1), LIN_PID(id + 2), LIN_PID(id + 3), \
+                            LIN_PID(id + 4), LIN_PID(id + 5), LIN_PID(id + 6), LIN_PID(id + 7)
+
+// protected ids of all 64 frame ids, replaces the parity calculation per frame
+static const uint8_t lin_pid[64] = {
+    LIN_PID_ROW(0x00), LIN_PID_ROW(0x08), LIN_PID_ROW(0x10), LIN_PID_ROW(0x18),
+    LIN_PID_ROW(0x20), LIN_PID_ROW(0x28), LIN_PID_ROW(0x30), LIN_PID_ROW(0x38)
+};
 
 
 void lin_init(void)
 {
+#if (LIN_DIRECT_ISR == 1)
+    // replaces the isr of the mcc driver, its ring buffers are not used
+    EUSART1_RxInterruptHandler = &cb_lin_rx;
+    EUSART1_TxInterruptHandler = &cb_lin_tx;
+#else
     UART1.RxCompleteCallbackRegister(&cb_lin_rx);
     UART1.TxCompleteCallbackRegister(&cb_lin_tx);
-    EUSART1_ReceiveDisable();
+    UART1.FramingErrorCallbackRegister(&cb_lin_framingError);
+    UART1.OverrunErrorCallbackRegister(&cb_lin_overrunError);
+#endif
+    LIN_RX_DISABLE();
     
     rx_byteCount = 0;
     tx_byteCount = 0;
+    rx_echoCount = 0;
+    rx_echoLength = 0;
+    lin_frameCompleteCallback = NULL;
+    lin_clearErrors();
         
     lin_state = LIN_BUS_READY;
 }
@@ -43,7 +97,7 @@ void lin_write(uint8_t node_id, uint8_t *data, uint8_t length)
     {
         if ((data != NULL) && (length > 0))
         {
-            pid = (lin_parity(node_id) | node_id);
+            pid = lin_pid[node_id & 0x3F];
 
             if (node_id == LIN_NODE_DIAG_TX) {
                 checksum = lin_checksum_classic(data, length);
@@ -59,77 +113,124 @@ void lin_write(uint8_t node_id, uint8_t *data, uint8_t length)
             }
 
             tx_packet.checksum = checksum;
+            tx_data = tx_packet.data;
 
-            tx_byteCount = 0;
+            rx_expected = 0;    // no response to wait for
             lin_state = LIN_BUS_SENDING;
-
-            EUSART1_SendBreakControlEnable();
-            UART1.Write(0x00);
+            lin_startFrame(node_id, length + 4);    // break, sync, pid, data and checksum
         }
     }
 }
 
-void lin_read(uint8_t node_id)
+void lin_writeFrame(const struct lin_frame *frame)
+{
+    // protected id and checksum were calculated at build time
+    if ((lin_state == LIN_BUS_READY) && (frame != NULL))
+    {
+        tx_packet.pid = frame->pid;
+        tx_packet.length = frame->length;
+        tx_packet.checksum = frame->checksum;
+        tx_data = frame->data;
+        
+        rx_expected = 0;
+        lin_state = LIN_BUS_SENDING;
+        lin_startFrame(frame->pid & 0x3F, frame->length + 4);
+    }
+}
+
+void lin_read(uint8_t node_id, uint8_t length)
 {    
     if (lin_state == LIN_BUS_READY)
     {                   
         lin_state = LIN_BUS_RECEIVING;
-        tx_byteCount = 0;
-        rx_byteCount = 0;
-        rx_node_pid = (lin_parity(node_id) | node_id);            
+        rx_expected = (length > 0) ? (length + 1) : 0;     // data + checksum
+        rx_node_pid = lin_pid[node_id & 0x3F];
+        rx_checksum = (node_id == LIN_NODE_DIAG_RX) ? 0 : rx_node_pid;     // classic for the diagnostic response
+        tx_packet.pid = rx_node_pid;
 
-        EUSART1_SendBreakControlEnable();
-        UART1.Write(0x00);        
+        lin_startFrame(node_id, 3);     // break, sync and pid
     }
 }
 
-uint8_t lin_getRxData(uint8_t *buffer)
+uint8_t lin_getRxData(uint8_t **data)
 {
-    // at this point, receiving data should be finished. therefore, we can 
-    // validate the checksum and if the packet was received correctly. 
-    uint8_t i, length = 0;
-    bool cc_correct;
+    // at this point, receiving data should be finished. the checksum of 
+    // everything before the last byte is already known, so only the last 
+    // byte has to be compared. the data is parsed in place and stays valid 
+    // until the next lin_read().
+    uint8_t length = 0;
     
-    if (rx_byteCount > 1)
-    {
-        cc_correct = lin_checksum_validation();
-        
-        if (cc_correct == true)
-        {
-            length = (rx_byteCount - 1);
-            
-            if (buffer != NULL)
-            {
-                // copy rx_data to buffer. ignore last byte which is checksum and was validated.
-                for (i=0; i<length; i++) {
-                    buffer[i] = rx_buffer[i];
-                }
-            }
-        }
+    if ((rx_byteCount > 1) && ((uint8_t) ~rx_checksum == rx_buffer[rx_byteCount - 1])) {
+        length = (rx_byteCount - 1);
+    }
+    
+    // nodes without a known response length may stay silent
+    if (rx_byteCount < rx_expected) {
+        LIN_COUNT_ERROR(LIN_ERROR_MISSING);
+    }
+    else if ((rx_byteCount > 1) && (length == 0)) {
+        LIN_COUNT_ERROR(LIN_ERROR_CHECKSUM);
     }
     
-    EUSART1_ReceiveDisable();
+    if (data != NULL) {
+        *data = rx_buffer;
+    }
+    
+    LIN_RX_DISABLE();
     rx_byteCount = 0;
     lin_state = LIN_BUS_READY;
     
     return length;
 } 
 
+void lin_setFrameCompleteCallback(void (*handler)(void))
+{
+    // called from interrupt context as soon as a frame is on the bus completely
+    lin_frameCompleteCallback = handler;
+}
 
-/**********************************************************
- * HELPER FUNCTIONS
- *********************************************************/
-static uint8_t lin_parity(uint8_t node_id)
+void lin_clearErrors(void)
 {
-	uint8_t par, p0, p1;
-	
-	p0 = BIT(node_id,0) ^ BIT(node_id,1) ^ BIT(node_id,2) ^ BIT(node_id,4);
-	p1 = ~(BIT(node_id,1) ^ BIT(node_id,3) ^ BIT(node_id,4) ^ BIT(node_id,5));
-	par = ((p0 | (p1<<1)) << 6);
+    uint8_t i, j;
+    
+    // only while the bus is quiet, the isr counts into lin_errorNode
+    for (i=0; i<LIN_ERROR_NODES; i++)
+    {
+        lin_errorTable[i].id = 0xFF;
+        
+        for (j=0; j<LIN_ERROR_MAX; j++) {
+            lin_errorTable[i].count[j] = 0;
+        }
+    }
+    lin_errorNode = &lin_errorSpare;
+}
 
-	return par;
+void lin_getErrors(uint8_t node_id, uint8_t *count)
+{
+    uint8_t i, j;
+    
+    // single bytes, so no counter is read while the isr is halfway through it. 
+    // a frame id which was never on the bus has no errors.
+    for (j=0; j<LIN_ERROR_MAX; j++) {
+        count[j] = 0;
+    }
+    
+    for (i=0; i<LIN_ERROR_NODES; i++)
+    {
+        if (lin_errorTable[i].id == node_id)
+        {
+            for (j=0; j<LIN_ERROR_MAX; j++) {
+                count[j] = lin_errorTable[i].count[j];
+            }
+            break;
+        }
+    }
 }
 
+
+/**********************************************************
+ * HELPER FUNCTIONS
+ *********************************************************/
 static uint8_t lin_checksum_classic(const uint8_t *data, uint8_t len)
 {
 	uint8_t     i;
@@ -166,30 +267,34 @@ static uint8_t lin_checksum_enhanced(uint8_t pid, const uint8_t *data, uint8_t l
 	return (uint8_t) cc;
 }
 
-static bool lin_checksum_validation()
+
+static void lin_startFrame(uint8_t node_id, uint8_t echo_length)
 {
-    bool isValid = false;
-    uint8_t data[8], length;
-    uint8_t i, calc_checksum, rx_checksum;    
+    uint8_t i;
     
-    rx_checksum = rx_buffer[rx_byteCount-1];
-    length = (rx_byteCount - 1);
+    // counters of the frame id, a free entry is taken on first use
+    lin_errorNode = &lin_errorSpare;
     
-    for (i=0; i<length; i++) {
-        data[i] = rx_buffer[i];
-    }
-
-    if (rx_node_pid == 0x7D) {  // there is only one DIAG_RX_NODE_PID
-        calc_checksum = lin_checksum_classic(data, length);
-    } else {
-        calc_checksum = lin_checksum_enhanced(rx_node_pid, data, length);
+    for (i=0; i<LIN_ERROR_NODES; i++)
+    {
+        if ((lin_errorTable[i].id == node_id) || (lin_errorTable[i].id == 0xFF))
+        {
+            lin_errorTable[i].id = node_id;
+            lin_errorNode = &lin_errorTable[i];
+            break;
+        }
     }
     
-    if (calc_checksum == rx_checksum) {
-        isValid = true;
-    }    
+    // the receiver runs from the break on, so every byte we send is read 
+    // back and compared. the break arrives as 0x00 with a framing error.
+    tx_byteCount = 0;
+    rx_byteCount = 0;
+    rx_echoCount = 0;
+    rx_echoLength = echo_length;
+    LIN_RX_ENABLE();
     
-    return isValid;
+    LIN_SEND_BREAK();
+    LIN_TX_BYTE(0x00);
 }
 
 
@@ -199,18 +304,81 @@ static bool lin_checksum_validation()
 
 static void cb_lin_rx()
 {
-    uint8_t rx_byte;
+    uint8_t rx_byte, expected;
+    bool framing;
+    
+#if (LIN_DIRECT_ISR == 1)
+    // an overrun stops the receiver until CREN is toggled
+    if (RC1STAbits.OERR == 1) {
+        LIN_COUNT_ERROR(LIN_ERROR_OVERRUN);
+        RC1STAbits.CREN = 0;
+        RC1STAbits.CREN = 1;
+    }
+    framing = RC1STAbits.FERR;
+#else
+    framing = rx_framingError;
+    rx_framingError = false;
+#endif
     
-    rx_byte = UART1.Read();
+    rx_byte = LIN_RX_BYTE();
     
-    if (lin_state == LIN_BUS_RECEIVING)
+    if (rx_echoCount == 0)
     {
-        if ((rx_byteCount == 0) && (rx_byte == rx_node_pid))
+        // a write is done once its checksum is in the shift register, so 
+        // its echo may still come in after the next break was queued
+        if ((framing == true) && (rx_byte == 0x00)) {
+            rx_echoCount++;
+        }
+        return;
+    }
+    
+    if (framing == true) {
+        LIN_COUNT_ERROR(LIN_ERROR_FRAMING);
+    }
+    
+    if (rx_echoCount < rx_echoLength)
+    {
+        if (rx_echoCount == 1) {
+            expected = LIN_SYNC_FIELD;
+        } 
+        else if (rx_echoCount == 2) {
+            expected = tx_packet.pid;
+        } 
+        else if ((rx_echoCount - 3) < tx_packet.length) {
+            expected = tx_data[rx_echoCount - 3];
+        } 
+        else {
+            expected = tx_packet.checksum;
+        }
+        
+        if (rx_byte != expected) {
+            LIN_COUNT_ERROR(LIN_ERROR_ECHO);
+        }
+        
+        rx_echoCount++;
+        
+        // a write ends with its echo, the receiver is not needed until the next frame
+        if ((rx_echoCount == rx_echoLength) && (lin_state != LIN_BUS_RECEIVING)) {
+            LIN_RX_DISABLE();
+        }
+    }
+    else if ((lin_state == LIN_BUS_RECEIVING) && (rx_byteCount < sizeof(rx_buffer)))
+    {
+        // the previous byte was data for sure, the last one is the checksum
+        if (rx_byteCount > 0)
         {
-            // ignore this first echo byte
-        } else {
-            rx_buffer[rx_byteCount] = rx_byte;        
-            rx_byteCount++;
+            rx_checksum += rx_buffer[rx_byteCount - 1];
+
+            if (rx_checksum > 255) {
+                rx_checksum -= 255;
+            }
+        }
+
+        rx_buffer[rx_byteCount] = rx_byte;        
+        rx_byteCount++;
+
+        if ((rx_byteCount == rx_expected) && (lin_frameCompleteCallback != NULL)) {
+            lin_frameCompleteCallback();
         }
     }
 } 
@@ -219,42 +387,61 @@ static void cb_lin_tx()
 {
     uint8_t index; 
     
+    LIN_TX_ACK();
+    
     if (lin_state == LIN_BUS_SENDING)
     {   // send a whole data packet
         if (tx_byteCount == 0) {
-            UART1.Write(LIN_SYNC_FIELD);
+            LIN_TX_BYTE(LIN_SYNC_FIELD);
         }
         else if (tx_byteCount == 1) {
-            UART1.Write(tx_packet.pid);
+            LIN_TX_BYTE(tx_packet.pid);
         }
         else if (tx_byteCount >= 2) {        
             index = tx_byteCount - 2;
 
             if (index < tx_packet.length) {
-                UART1.Write(tx_packet.data[index]);
+                LIN_TX_BYTE(tx_data[index]);
             }
             else if (index == tx_packet.length) {
-                UART1.Write(tx_packet.checksum);
+                LIN_TX_BYTE(tx_packet.checksum);
             }
             else {
                 // last byte was transmitted
                 lin_state = LIN_BUS_READY;
+                
+                if (lin_frameCompleteCallback != NULL) {
+                    lin_frameCompleteCallback();
+                }
             }
         }
     }
     else if (lin_state == LIN_BUS_RECEIVING)
     {   // just send a read announcement
         if (tx_byteCount == 0) {
-            UART1.Write(LIN_SYNC_FIELD);
+            LIN_TX_BYTE(LIN_SYNC_FIELD);
         }
         else if (tx_byteCount == 1) {
-            UART1.Write(rx_node_pid);
-        }
-        else {
-            // after last byte was transmitted, we are now ready to receive data
-            EUSART1_ReceiveEnable();
+            LIN_TX_BYTE(rx_node_pid);
         }
     }
     
     tx_byteCount++;
-}
\ No newline at end of file
+}
+
+#if (LIN_DIRECT_ISR == 0)
+static void cb_lin_framingError()
+{
+    // called by the driver right before cb_lin_rx() receives the byte
+    rx_framingError = true;
+}
+
+static void cb_lin_overrunError()
+{
+    LIN_COUNT_ERROR(LIN_ERROR_OVERRUN);
+    
+    // the default handler of the driver, the receiver stops until CREN is toggled
+    RC1STAbits.CREN = 0;
+    RC1STAbits.CREN = 1;
+}
+#endif
\ No newline at end of file
@@ -54,6 +54,21 @@
 #define LIN_NODE_DIAG_RX			0x3D
 #define LIN_SYNC_FIELD              0x55
 #define LIN_DIAG_PACKET_LEN         8
+#define LIN_ERROR_NODES             8       /**< frame ids with error counters, assigned in order of first use */
+
+#ifndef LIN_DIRECT_ISR
+#define LIN_DIRECT_ISR              1       /**< 1 = lin.c services RC1REG/TX1REG in the isr, 0 = MCC EUSART1 driver */
+#endif
+
+// protected id and checksum of frames known at build time. the sum of all 
+// bytes is folded like the end-around carry of lin_checksum_classic().
+#define LIN_PID(id)                 ((id) | ((BIT((id),0) ^ BIT((id),1) ^ BIT((id),2) ^ BIT((id),4)) << 6) | \
+                                    ((~(BIT((id),1) ^ BIT((id),3) ^ BIT((id),4) ^ BIT((id),5)) & 1) << 7))
+#define LIN_CHECKSUM(sum)           ((uint8_t) (((sum) == 0) ? 0xFF : ~((((sum) - 1) % 255) + 1)))
+#define LIN_DIAG_FRAME(d0,d1,d2,d3,d4,d5,d6,d7) \
+    { LIN_PID(LIN_NODE_DIAG_TX), LIN_DIAG_PACKET_LEN, \
+      LIN_CHECKSUM((d0) + (d1) + (d2) + (d3) + (d4) + (d5) + (d6) + (d7)), \
+      { (d0), (d1), (d2), (d3), (d4), (d5), (d6), (d7) } }
 
 
 enum lin_bus_state {
@@ -63,6 +78,21 @@ enum lin_bus_state {
     LIN_BUS_RECEIVING
 };
 
+enum lin_error {
+    LIN_ERROR_CHECKSUM,     /**< response with a wrong checksum */
+    LIN_ERROR_MISSING,      /**< no or an incomplete response */
+    LIN_ERROR_FRAMING,      /**< stop bit not found, the break itself is not counted */
+    LIN_ERROR_OVERRUN,      /**< byte lost, the isr was too late */
+    LIN_ERROR_ECHO,         /**< own byte read back differently, another node talked */
+    LIN_ERROR_MAX
+};
+
+/** error counters of a frame id, saturating at 255 */
+struct lin_errors {
+    uint8_t id;
+    uint8_t count[LIN_ERROR_MAX];
+};
+
 struct lin_packet {
     uint8_t pid;
     uint8_t data[LIN_DIAG_PACKET_LEN];
@@ -70,20 +100,35 @@ struct lin_packet {
     uint8_t checksum;
 };
 
+/** a frame with a constant payload, kept in flash and sent as is */
+struct lin_frame {
+    uint8_t pid;
+    uint8_t length;
+    uint8_t checksum;
+    uint8_t data[LIN_DIAG_PACKET_LEN];
+};
+
 
 void lin_init(void);
 void lin_deinit(void);
 void lin_write(uint8_t node_id, uint8_t *data, uint8_t length);
-void lin_read(uint8_t node_id);
-uint8_t lin_getRxData(uint8_t *buffer);
+void lin_writeFrame(const struct lin_frame *frame);
+void lin_read(uint8_t node_id, uint8_t length);
+uint8_t lin_getRxData(uint8_t **data);
+void lin_setFrameCompleteCallback(void (*handler)(void));
+void lin_clearErrors(void);
+void lin_getErrors(uint8_t node_id, uint8_t *count);
 
-static uint8_t lin_parity(uint8_t node_id);
 static uint8_t lin_checksum_classic(const uint8_t *data, uint8_t len);
 static uint8_t lin_checksum_enhanced(uint8_t pid, const uint8_t *data, uint8_t len);
-static bool    lin_checksum_validation();
+static void lin_startFrame(uint8_t node_id, uint8_t echo_length);
 
 static void cb_lin_rx();
 static void cb_lin_tx();
+#if (LIN_DIRECT_ISR == 0)
+static void cb_lin_framingError();
+static void cb_lin_overrunError();
+#endif
 
 
 #endif	/* LIN_H */
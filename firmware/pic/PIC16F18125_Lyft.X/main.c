@@ -32,6 +32,7 @@
     EXCEED AMOUNT OF FEES, IF ANY, YOU PAID DIRECTLY TO MICROCHIP FOR 
     THIS SOFTWARE.
 */
+#include <stddef.h>
 #include "mcc_generated_files/system/system.h"
 #include "config.h"
 #include "bekant.h"
@@ -42,37 +43,60 @@
 */
 
 
-static void respond_callDeskInit();
-static void respond_callDeskDeinit();
-static void respond_callDeskCalibration();
+#define APP_DESK_COMMAND    0x01    // changes the desk, deferred until the lin cycle is done
+#define APP_REG_U16         0x02    // getter reads a 16 bit register, sent big endian
+#define APP_REG_OPERATION   0x04    // register is only valid once the desk is in operation
 
-static void respond_getDeskState();
-static void respond_getDeskDrift();
-static void respond_getDeskPosition();
-static void respond_getDeskUpperLimit();
-static void respond_getDeskLowerLimit();
+#define APP_REG(member)     ((uint8_t) offsetof(struct desk_snapshot, member))
 
-static void respond_setDeskHalt();
-static void respond_setDeskPosition(uint16_t position);
 
-static void respond_getMotorState(uint8_t unit);
-static void respond_getMotorNodeId(uint8_t unit);
-static void respond_getMotorScanId(uint8_t unit);
-static void respond_getMotorProperty(uint8_t unit);
-static void respond_getMotorPosition(uint8_t unit);
-static void respond_getMotorUpperLimit(uint8_t unit);
-static void respond_getMotorLowerLimit(uint8_t unit);
+/**
+ * One entry per host command. A handler writes the response data (error code 
+ * first) and returns its length. Entries without handler are answered by the 
+ * generic getter with the register at offset arg of the published snapshot, 
+ * otherwise arg is passed to the handler (e.g. the motor unit).
+ */
+struct app_command {
+    uint8_t     command;
+    uint8_t     length;     // request data length
+    uint8_t     flags;
+    uint8_t     arg;
+    uint8_t     (*respond)(uint8_t arg, const uint8_t *request, uint8_t *response);
+};
 
-static void respond_getBoardRevision();
-static void respond_getFirmwareVersion();
-static void respond_getProtocolVersion();
 
-static void respond_callWatchdogEnable();
-static void respond_callWatchdogDisable();
+static uint8_t respond_callDeskInit(uint8_t arg, const uint8_t *request, uint8_t *response);
+static uint8_t respond_callDeskDeinit(uint8_t arg, const uint8_t *request, uint8_t *response);
+static uint8_t respond_callDeskCalibration(uint8_t arg, const uint8_t *request, uint8_t *response);
 
-static void respond_invalidCommand(uint8_t command);
-static void respond_invalidChecksum(uint8_t command);
-static void respond_invalidData(uint8_t command);
+static uint8_t respond_getDeskSnapshot(uint8_t arg, const uint8_t *request, uint8_t *response);
+static uint8_t respond_getDeskBusErrors(uint8_t arg, const uint8_t *request, uint8_t *response);
+
+static uint8_t respond_setDeskHalt(uint8_t arg, const uint8_t *request, uint8_t *response);
+static uint8_t respond_setDeskPosition(uint8_t arg, const uint8_t *request, uint8_t *response);
+static uint8_t respond_setDeskStream(uint8_t arg, const uint8_t *request, uint8_t *response);
+static uint8_t respond_setDeskWaypoint(uint8_t arg, const uint8_t *request, uint8_t *response);
+
+static uint8_t respond_getMotorNodeId(uint8_t arg, const uint8_t *request, uint8_t *response);
+
+static uint8_t respond_getBoardRevision(uint8_t arg, const uint8_t *request, uint8_t *response);
+static uint8_t respond_getFirmwareVersion(uint8_t arg, const uint8_t *request, uint8_t *response);
+static uint8_t respond_getProtocolVersion(uint8_t arg, const uint8_t *request, uint8_t *response);
+
+static uint8_t respond_callWatchdogEnable(uint8_t arg, const uint8_t *request, uint8_t *response);
+static uint8_t respond_callWatchdogDisable(uint8_t arg, const uint8_t *request, uint8_t *response);
+
+static uint8_t respond_setHostBaudrate(uint8_t arg, const uint8_t *request, uint8_t *response);
+
+static uint8_t respond_getRegister(const struct app_command *entry, uint8_t *response);
+static void respond_error(uint8_t error);
+
+static void stream_process();
+
+void app_init();
+void app_process();
+bool app_isWarmReset(uint8_t reset_cause);
+const struct app_command *app_findCommand(uint8_t command);
 
 void wdt_enable();
 void wdt_disable();
@@ -81,119 +105,217 @@ void wdt_clear();
 void cb_tmr0();
 
 
+// sorted by command
+static const struct app_command app_commands[] = {
+    { GET_DESK_STATE,               0, 0,                   APP_REG(op_mode),                       NULL },
+    { GET_DESK_DRIFT,               0, 0,                   APP_REG(drift),                         NULL },
+    { GET_DESK_POSITION,            0, APP_REG_U16 | APP_REG_OPERATION, APP_REG(position),          NULL },
+    { GET_DESK_UPPER_LIMIT,         0, APP_REG_U16,         APP_REG(upper_limit),                   NULL },
+    { GET_DESK_LOWER_LIMIT,         0, APP_REG_U16,         APP_REG(lower_limit),                   NULL },
+    { GET_DESK_SNAPSHOT,            0, 0,                   0,                                      &respond_getDeskSnapshot },
+    { GET_DESK_BUS_ERRORS,          1, 0,                   0,                                      &respond_getDeskBusErrors },
+    { GET_DESK_WAYPOINTS,           0, 0,                   APP_REG(waypoints),                     NULL },
+    
+    { GET_MOTOR_LEFT_STATE,         0, 0,                   APP_REG(motor[UNIT_LEFT].state),        NULL },
+    { GET_MOTOR_LEFT_POSITION,      0, APP_REG_U16,         APP_REG(motor[UNIT_LEFT].position),     NULL },
+    { GET_MOTOR_LEFT_UPPER_LIMIT,   0, APP_REG_U16,         APP_REG(motor[UNIT_LEFT].upper_limit),  NULL },
+    { GET_MOTOR_LEFT_LOWER_LIMIT,   0, APP_REG_U16,         APP_REG(motor[UNIT_LEFT].lower_limit),  NULL },
+    { GET_MOTOR_LEFT_NODE_ID,       0, 0,                   UNIT_LEFT,                              &respond_getMotorNodeId },
+    { GET_MOTOR_LEFT_SCAN_ID,       0, 0,                   APP_REG(motor[UNIT_LEFT].scan_id),      NULL },
+    { GET_MOTOR_LEFT_PROPERTY,      0, 0,                   APP_REG(motor[UNIT_LEFT].property),     NULL },
+    
+    { GET_MOTOR_RIGHT_STATE,        0, 0,                   APP_REG(motor[UNIT_RIGHT].state),       NULL },
+    { GET_MOTOR_RIGHT_POSITION,     0, APP_REG_U16,         APP_REG(motor[UNIT_RIGHT].position),    NULL },
+    { GET_MOTOR_RIGHT_UPPER_LIMIT,  0, APP_REG_U16,         APP_REG(motor[UNIT_RIGHT].upper_limit), NULL },
+    { GET_MOTOR_RIGHT_LOWER_LIMIT,  0, APP_REG_U16,         APP_REG(motor[UNIT_RIGHT].lower_limit), NULL },
+    { GET_MOTOR_RIGHT_NODE_ID,      0, 0,                   UNIT_RIGHT,                             &respond_getMotorNodeId },
+    { GET_MOTOR_RIGHT_SCAN_ID,      0, 0,                   APP_REG(motor[UNIT_RIGHT].scan_id),     NULL },
+    { GET_MOTOR_RIGHT_PROPERTY,     0, 0,                   APP_REG(motor[UNIT_RIGHT].property),    NULL },
+    
+    { CALL_DESK_INIT,               0, APP_DESK_COMMAND,    0,                                      &respond_callDeskInit },
+    { CALL_DESK_DEINIT,             0, APP_DESK_COMMAND,    0,                                      &respond_callDeskDeinit },
+    { CALL_DESK_CALIBRATION,        0, APP_DESK_COMMAND,    0,                                      &respond_callDeskCalibration },
+    
+    { SET_DESK_POSITION,            2, APP_DESK_COMMAND,    0,                                      &respond_setDeskPosition },
+    { SET_DESK_HALT,                0, APP_DESK_COMMAND,    0,                                      &respond_setDeskHalt },
+    { SET_DESK_STREAM,              1, APP_DESK_COMMAND,    0,                                      &respond_setDeskStream },
+    { SET_DESK_WAYPOINT,            4, APP_DESK_COMMAND,    0,                                      &respond_setDeskWaypoint },
+    
+    { GET_PROTOCOL_VERSION,         0, 0,                   0,                                      &respond_getProtocolVersion },
+    { GET_FIRMWARE_VERSION,         0, 0,                   0,                                      &respond_getFirmwareVersion },
+    { GET_BOARD_REVISION,           0, 0,                   0,                                      &respond_getBoardRevision },
+    { CALL_WATCHDOG_ENABLE,         0, 0,                   0,                                      &respond_callWatchdogEnable },
+    { CALL_WATCHDOG_DISABLE,        0, 0,                   0,                                      &respond_callWatchdogDisable },
+    { SET_HOST_BAUDRATE,            1, 0,                   0,                                      &respond_setHostBaudrate },
+};
+
+#define APP_COMMAND_COUNT   (sizeof(app_commands) / sizeof(app_commands[0]))
+
+
 bool wdt_isEnabled;
 bool event_trigger;
 
+uint8_t stream_mode;
+uint8_t stream_sequence;
+uint8_t stream_payload[4];  // state, position and drift of the last pushed frame
+bool stream_isPending;      // nothing was pushed since the subscription
+
 
 int main(void)
 {
-    uint16_t position;
-    enum desk_state op_mode;
-    struct host_data_packet host_request;
+    app_init();
+
+    while(1)
+    {
+        app_process();
+    }    
+}
+
+
+void app_init()
+{
+    uint8_t reset_cause = PCON0;    // SYSTEM_Initialize() re-arms the watchdog flags
+    
+    PCON0bits.nPOR = 1;
+    PCON0bits.nBOR = 1;
     
     SYSTEM_Initialize();
     TMR0_OverflowCallbackRegister(&cb_tmr0);    // timer set to 5ms
     
     wdt_isEnabled = false;
     event_trigger = false;
+    stream_mode = STREAM_OFF;
  
     desk_init(true);
     host_init();
     
+    if ((app_isWarmReset(reset_cause) == true) && (desk_resume() == true))
+    {
+        TMR0_Start();
+        
+        if ((reset_cause & _PCON0_nRWDT_MASK) == 0) {
+            wdt_enable();   // the host enabled it before
+        }
+    }
+    
     INTERRUPT_GlobalInterruptEnable(); 
     INTERRUPT_PeripheralInterruptEnable(); 
     
     //desk_startup();
+}
 
-    while(1)
+void app_process()
+{
+    enum desk_state op_mode;
+    const struct app_command *entry;
+    const struct host_data_packet *host_request;
+    struct host_data_packet *host_response;
+    
+    if (event_trigger == true)
     {
-        if (event_trigger == true)
-        {
-            op_mode = desk_getOpMode();
-            if ((op_mode & STARTUP) == STARTUP) {
-                desk_startup();
-            }
-            else if ((op_mode & OPERATION) == OPERATION) {
-                desk_operation();
-            } else {
-                // desk is idle - do nothing.
-            }
-
-            event_trigger = false;
+        op_mode = desk_getOpMode();
+        if ((op_mode & STARTUP) == STARTUP) {
+            desk_startup();
+        }
+        else if ((op_mode & OPERATION) == OPERATION) {
+            desk_operation();
+        } else {
+            // desk is idle - do nothing.
         }
+
+        event_trigger = false;
+    }
+    
+    host_process();
+    
+    if (stream_mode != STREAM_OFF) {
+        stream_process();
+    }
+    
+    if ((host_newDataAvailable() == false) || (host_isWritable() == false)) {
+        return;
+    }
+    
+    // requests which change the desk are only processed after desk communication 
+    // is done. this ensures un-interrupted desk communication. all others are 
+    // answered right away from the snapshot published at the end of the last cycle.
+    // the response is queued behind frames which are still being sent.
+    entry = app_findCommand(host_peekCommand());
+    
+    if ((entry != NULL) && ((entry->flags & APP_DESK_COMMAND) != 0) && (desk_isBusy() == true)) {
+        return;
+    }
+    
+    if (wdt_isEnabled == true) {
+        wdt_clear();
+    }
+    
+    // the request is validated in its rx slot and the response is built in 
+    // its tx slot. the rx slot is released once the response is queued.
+    host_request = host_read();
+    
+    if (host_request->isValid == false) {
+        respond_error(E_INVALID_CHECKSUM);
+    }
+    else if (entry == NULL) {
+        respond_error(E_INVALID_COMMAND);
+    }
+    else if (host_request->length != entry->length) {
+        respond_error(E_INVALID_DATA);
+    }
+    else
+    {
+        host_response = host_beginResponse();
         
-        if ((host_newDataAvailable() == true) && (desk_isBusy() == false))
-        {
-            if (wdt_isEnabled == true) {
-                wdt_clear();
-            }
-            
-            // only process host_requests after desk communication is done. 
-            // this ensures un-interrupted desk communication as well as stable values of data. 
-            host_read(&host_request);
-            
-            if (host_verifyChecksum(host_request) == true)
-            {
-                switch (host_request.command)
-                {
-                    case CALL_DESK_INIT: respond_callDeskInit(); break;
-                    case CALL_DESK_DEINIT: respond_callDeskDeinit(); break;
-                    case CALL_DESK_CALIBRATION: respond_callDeskCalibration(); break;
-                    
-                    case GET_DESK_STATE: respond_getDeskState(); break; 
-                    case GET_DESK_DRIFT: respond_getDeskDrift(); break; 
-                    case GET_DESK_POSITION: respond_getDeskPosition(); break;                    
-                    case GET_DESK_UPPER_LIMIT: respond_getDeskUpperLimit(); break;
-                    case GET_DESK_LOWER_LIMIT: respond_getDeskLowerLimit(); break;
-                    
-                    case SET_DESK_HALT: respond_setDeskHalt(); break;
-                    case SET_DESK_POSITION: 
-                        if (host_request.length == 2) {
-                            position = ((host_request.data[0] << 8) | host_request.data[1]);
-                            respond_setDeskPosition(position);
-                        } else {
-                            respond_invalidData(host_request.command);
-                        }
-                        break;
-                    
-                    case GET_MOTOR_LEFT_STATE: respond_getMotorState(UNIT_LEFT); break;
-                    case GET_MOTOR_LEFT_POSITION: respond_getMotorPosition(UNIT_LEFT); break;
-                    case GET_MOTOR_LEFT_UPPER_LIMIT: respond_getMotorUpperLimit(UNIT_LEFT); break;
-                    case GET_MOTOR_LEFT_LOWER_LIMIT: respond_getMotorLowerLimit(UNIT_LEFT); break;
-                    case GET_MOTOR_LEFT_PROPERTY: respond_getMotorProperty(UNIT_LEFT); break;
-                    case GET_MOTOR_LEFT_NODE_ID: respond_getMotorNodeId(UNIT_LEFT); break;
-                    case GET_MOTOR_LEFT_SCAN_ID: respond_getMotorScanId(UNIT_LEFT); break;
-                        
-                    case GET_MOTOR_RIGHT_STATE: respond_getMotorState(UNIT_RIGHT); break;
-                    case GET_MOTOR_RIGHT_POSITION: respond_getMotorPosition(UNIT_RIGHT); break;
-                    case GET_MOTOR_RIGHT_UPPER_LIMIT: respond_getMotorUpperLimit(UNIT_RIGHT); break;
-                    case GET_MOTOR_RIGHT_LOWER_LIMIT: respond_getMotorLowerLimit(UNIT_RIGHT); break;
-                    case GET_MOTOR_RIGHT_PROPERTY: respond_getMotorProperty(UNIT_RIGHT); break;
-                    case GET_MOTOR_RIGHT_NODE_ID: respond_getMotorNodeId(UNIT_RIGHT); break;
-                    case GET_MOTOR_RIGHT_SCAN_ID: respond_getMotorScanId(UNIT_RIGHT); break;
-                    
-                    case GET_BOARD_REVISION: respond_getBoardRevision(); break;
-                    case GET_FIRMWARE_VERSION: respond_getFirmwareVersion(); break;
-                    case GET_PROTOCOL_VERSION: respond_getProtocolVersion(); break;
-                    
-                    case CALL_WATCHDOG_ENABLE: respond_callWatchdogEnable(); break;
-                    case CALL_WATCHDOG_DISABLE: respond_callWatchdogDisable(); break;
-
-                    default: respond_invalidCommand(host_request.command); break;
-                }
-            }
-            else 
-            {
-                respond_invalidChecksum(host_request.command);
-            }
+        if (entry->respond != NULL) {
+            host_response->length = entry->respond(entry->arg, host_request->data, host_response->data);
+        } else {
+            host_response->length = respond_getRegister(entry, host_response->data);
         }
-    }    
+        
+        host_send(host_response);
+    }
+    
+    host_release();
+}
+
+bool app_isWarmReset(uint8_t reset_cause)
+{
+    // ram is kept on a watchdog reset and on a brown-out without power loss
+    if ((reset_cause & _PCON0_nRWDT_MASK) == 0) {
+        return true;
+    }
+    
+    return ((reset_cause & (_PCON0_nPOR_MASK | _PCON0_nBOR_MASK)) == _PCON0_nPOR_MASK);
 }
 
+const struct app_command *app_findCommand(uint8_t command)
+{
+    uint8_t low, high, mid;
+    
+    // binary search, the table is sorted by command
+    low = 0;
+    high = APP_COMMAND_COUNT;
+    
+    while (low < high)
+    {
+        mid = ((low + high) >> 1);
+        
+        if (app_commands[mid].command == command) {
+            return &app_commands[mid];
+        } else if (app_commands[mid].command < command) {
+            low = (mid + 1);
+        } else {
+            high = mid;
+        }
+    }
+    
+    return NULL;
+}
 
 void wdt_enable()
 {
-    volatile uint8_t t = WDTCON0;
+    (void) WDTCON0;
     WDTCON0bits.WDTSEN = 0b1;
     wdt_isEnabled = true;
 }
@@ -206,7 +328,7 @@ void wdt_disable()
 
 void wdt_clear()
 {
-    volatile uint8_t t = WDTCON0;   // arm the WDT before clearing it
+    (void) WDTCON0;                 // arm the WDT before clearing it
     CLRWDT();
 } 
 
@@ -215,174 +337,124 @@ void cb_tmr0()
     event_trigger = true;
 }
 
-static void respond_callDeskInit()
+static uint8_t respond_getRegister(const struct app_command *entry, uint8_t *response)
 {
-    uint8_t state;
-    struct host_data_packet host_response;
+    uint16_t value;
+    const uint8_t *reg;
     
-    state = desk_getOpMode();
-    host_response.command = (CALL_DESK_INIT | 0x80);
-    host_response.length = 1;
+    if (((entry->flags & APP_REG_OPERATION) != 0) && ((desk_getOpMode() & OPERATION) != OPERATION)) {
+        response[0] = E_DESK_NOT_READY;
+        return 1;
+    }
+    
+    reg = (((const uint8_t *) desk_getSnapshot()) + entry->arg);
+    response[0] = E_OK;
+    
+    if ((entry->flags & APP_REG_U16) != 0)
+    {
+        value = *((const uint16_t *) reg);
+        response[1] = ((value & 0xFF00) >> 8);
+        response[2] = (value & 0xFF);
+        return 3;
+    }
+    
+    response[1] = *reg;
+    return 2;
+}
+
+static void respond_error(uint8_t error)
+{
+    struct host_data_packet *host_response = host_beginResponse();
+    
+    host_response->length = 1;
+    host_response->data[0] = error;
     
-    if (state == IDLE)
+    host_send(host_response);
+}
+
+static uint8_t respond_callDeskInit(uint8_t arg, const uint8_t *request, uint8_t *response)
+{
+    if (desk_getOpMode() == IDLE)
     {
+        desk_clearBusErrors();  // the bus is quiet until the startup begins
         desk_startup();
         TMR0_Start();     // timer has to be enabled all time since it's used for the watchdog
         //wdt_enable();
         
-        host_response.data[0] = E_OK;
+        response[0] = E_OK;
     }
     else
     {
-        host_response.data[0] = E_DESK_NOT_IDLE;        
+        response[0] = E_DESK_NOT_IDLE;        
     }
 
-    host_calcChecksum(&host_response);
-    host_write(host_response);
+    return 1;
 }
 
-static void respond_callDeskDeinit()
+static uint8_t respond_callDeskDeinit(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    struct host_data_packet host_response;
-    
     TMR0_Stop();      
     wdt_disable();
     desk_init(false);
+    stream_mode = STREAM_OFF;
     
-    host_response.command = (CALL_DESK_DEINIT | 0x80);
-    host_response.length = 1;
-    host_response.data[0] = E_OK;
-    host_calcChecksum(&host_response);
-
-    host_write(host_response);
+    response[0] = E_OK;
+    return 1;
 }
 
-static void respond_callDeskCalibration()
+static uint8_t respond_callDeskCalibration(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    uint8_t state;
-    struct host_data_packet host_response;
-    
-    state = desk_getOpMode();
-    host_response.command = (CALL_DESK_CALIBRATION | 0x80);
-    host_response.length = 1;
-    
-    if (state == OPERATION_NORMAL) 
+    if (desk_getOpMode() == OPERATION_NORMAL) 
     {
         desk_runCalibration();
-        host_response.data[0] = E_OK;
+        response[0] = E_OK;
     }
     else
     {
-        host_response.data[0] = E_DESK_BUSY;
+        response[0] = E_DESK_BUSY;
     }
         
-    host_calcChecksum(&host_response);    
-    host_write(host_response);
+    return 1;
 }
 
-static void respond_getBoardRevision()
+static uint8_t respond_getBoardRevision(uint8_t arg, const uint8_t *request, uint8_t *response)
 {    
-    struct host_data_packet host_response;
-    
-    host_response.command = (GET_BOARD_REVISION | 0x80);
-    host_response.length = 4;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = (uint8_t) BOARD_REVISION[0];
-    host_response.data[2] = (uint8_t) BOARD_REVISION[1];
-    host_response.data[3] = (uint8_t) BOARD_REVISION[2];    
-    host_calcChecksum(&host_response);
-        
-    host_write(host_response);
+    response[0] = E_OK;
+    response[1] = (uint8_t) BOARD_REVISION[0];
+    response[2] = (uint8_t) BOARD_REVISION[1];
+    response[3] = (uint8_t) BOARD_REVISION[2];    
+    return 4;
 }
 
-static void respond_getFirmwareVersion()
+static uint8_t respond_getFirmwareVersion(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    struct host_data_packet host_response;
-    
-    host_response.command = (GET_FIRMWARE_VERSION | 0x80);
-    host_response.length = 4;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = FIRMWARE_VERSION_MAJOR; 
-    host_response.data[2] = FIRMWARE_VERSION_MINOR;
-    host_response.data[3] = FIRMWARE_VERSION_PATCH;
-    host_calcChecksum(&host_response);
-
-    host_write(host_response);
+    response[0] = E_OK;
+    response[1] = FIRMWARE_VERSION_MAJOR; 
+    response[2] = FIRMWARE_VERSION_MINOR;
+    response[3] = FIRMWARE_VERSION_PATCH;
+    return 4;
 }
 
-static void respond_getProtocolVersion()
+static uint8_t respond_getProtocolVersion(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    struct host_data_packet host_response;
-    
-    host_response.command = (GET_PROTOCOL_VERSION | 0x80);
-    host_response.length = 2;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = PROTOCOL_VERSION; 
-    host_calcChecksum(&host_response);
-
-    host_write(host_response);
-}
-
-static void respond_getDeskDrift()
-{
-    uint8_t drift;
-    struct host_data_packet host_response;
-    
-    drift = desk_getDrift();
-    
-    host_response.command = (GET_DESK_DRIFT | 0x80);
-    host_response.length = 2;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = drift; 
-    host_calcChecksum(&host_response);
-
-    host_write(host_response);
-}
-
-static void respond_getDeskPosition()
-{
-    uint8_t state;
-    uint16_t position;
-    struct host_data_packet host_response;
-    
-    state = desk_getOpMode();    
-    host_response.command = (GET_DESK_POSITION | 0x80);
-    
-    if ((state & OPERATION) == OPERATION)
-    {
-        position = desk_getPosition();
-    
-        host_response.length = 3;
-        host_response.data[0] = E_OK;
-        host_response.data[1] = ((position & 0xFF00) >> 8); 
-        host_response.data[2] = (position & 0x00FF);
-        
-    }
-    else
-    {
-        host_response.length = 1;
-        host_response.data[0] = E_DESK_NOT_READY;
-    }
-    
-    host_calcChecksum(&host_response);
-    host_write(host_response);
+    response[0] = E_OK;
+    response[1] = PROTOCOL_VERSION; 
+    return 2;
 }
 
-static void respond_setDeskPosition(uint16_t position)
+static uint8_t respond_setDeskPosition(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
     uint8_t state;
     uint16_t diff;
+    uint16_t position;
     uint16_t current_position;
     uint16_t upper_limit, lower_limit;
-    struct host_data_packet host_response;
     
+    position = ((request[0] << 8) | request[1]);
     state = desk_getOpMode();
     upper_limit = desk_getUpperLimit();
     lower_limit = desk_getLowerLimit();
     current_position = desk_getPosition();
-    host_response.command = (SET_DESK_POSITION | 0x80);
-    host_response.length = 1;
-    
     // some preliminary checks
     if (state == OPERATION_NORMAL)
     {
@@ -390,25 +462,25 @@ static void respond_setDeskPosition(uint16_t position)
         {            
             if (position > current_position) 
             { // we want to go up                
-                if (upper_limit > (current_position + DESK_STOPPING_DISTANCE))
+                if (upper_limit > (current_position + DESK_FINE_DISTANCE_MIN))
                 {                    
                     diff = (position - current_position);
                 
-                    if (diff > DESK_STOPPING_DISTANCE) 
+                    if (diff > DESK_FINE_DISTANCE_MIN) 
                     {
                         desk_setPosition(position);        
-                        host_response.data[0] = E_OK;  
+                        response[0] = E_OK;  
                     }
                     else
                     {
                         // error min distance
-                        host_response.data[0] = E_DESK_MIN_DISTANCE;
+                        response[0] = E_DESK_MIN_DISTANCE;
                     }                 
                 }
                 else 
                 {
                     // error upper limit reached
-                    host_response.data[0] = E_DESK_UPPER_LIMIT_REACHED;
+                    response[0] = E_DESK_UPPER_LIMIT_REACHED;
                 }
             }
             
@@ -416,356 +488,251 @@ static void respond_setDeskPosition(uint16_t position)
             { // we want to go down 
                 
                 
-                if (lower_limit < (current_position - DESK_STOPPING_DISTANCE))
+                if (lower_limit < (current_position - DESK_FINE_DISTANCE_MIN))
                 {                    
                     diff = (current_position - position);
                 
-                    if (diff > DESK_STOPPING_DISTANCE) 
+                    if (diff > DESK_FINE_DISTANCE_MIN) 
                     {
                         desk_setPosition(position);        
-                        host_response.data[0] = E_OK;  
+                        response[0] = E_OK;  
                     }
                     else
                     {
                         // error min distance
-                        host_response.data[0] = E_DESK_MIN_DISTANCE;
+                        response[0] = E_DESK_MIN_DISTANCE;
                     }                 
                 }
                 else 
                 {
                     // error lower limit reached
-                    host_response.data[0] = E_DESK_LOWER_LIMIT_REACHED;
+                    response[0] = E_DESK_LOWER_LIMIT_REACHED;
                 }
             }
         }
         else
         {
-            host_response.data[0] = E_INVALID_DATA;
+            response[0] = E_INVALID_DATA;
+        }
+    }
+    else if ((state == OPERATION_ANNOUNCING) || (state == OPERATION_MOVING_UP) || (state == OPERATION_MOVING_DOWN) || 
+             (state == OPERATION_MOVING_SLOW) || (state == OPERATION_MOVING_STOP) || (state == OPERATION_MOVING_FINE) || 
+             (state == OPERATION_DWELLING))
+    {
+        // a new target while moving, desk_setPosition() either carries on 
+        // or stops and comes back once the desk rests
+        if ((lower_limit <= position) && (position <= upper_limit))
+        {
+            desk_setPosition(position);
+            response[0] = E_OK;
+        }
+        else
+        {
+            response[0] = E_INVALID_DATA;
         }
     }
     else 
     {
-        host_response.data[0] = E_DESK_BUSY;
+        response[0] = E_DESK_BUSY;
     }
         
-    host_calcChecksum(&host_response);         
-    host_write(host_response);
+        
+    return 1;
 }
 
-static void respond_getDeskUpperLimit()
+static uint8_t respond_getDeskSnapshot(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    uint16_t limit;
-    struct host_data_packet host_response;
+    uint8_t i, unit;
+    uint16_t value;
+    
+    // everything the host polls while the desk is moving, in one frame
+    response[0] = E_OK;
+    response[1] = desk_getSequence();
+    response[2] = desk_getOpMode();
     
-    limit = desk_getUpperLimit();
+    value = desk_getPosition();
+    response[3] = ((value & 0xFF00) >> 8);
+    response[4] = (value & 0xFF);
+    response[5] = desk_getDrift();
     
-    host_response.command = (GET_DESK_UPPER_LIMIT | 0x80);
-    host_response.length = 3;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = ((limit & 0xFF00) >> 8); 
-    host_response.data[2] = (limit & 0x00FF);
+    for (unit=UNIT_LEFT, i=6; unit<UNIT_MAX; unit++, i+=4)
+    {
+        value = motor_getPosition(unit);
+        response[i] = ((value & 0xFF00) >> 8);
+        response[i + 1] = (value & 0xFF);
+        response[i + 2] = motor_getState(unit);
+        response[i + 3] = motor_getOutageCount(unit);
+    }
     
-    host_calcChecksum(&host_response);
-    host_write(host_response);
+    return 14;
 }
 
-static void respond_getDeskLowerLimit()
+static uint8_t respond_getDeskBusErrors(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    uint16_t limit;
-    struct host_data_packet host_response;
+    // request[0] is the lin frame id, 0x00 to 0x3F
+    if (request[0] > 0x3F) {
+        response[0] = E_INVALID_DATA;
+        return 1;
+    }
     
-    limit = desk_getLowerLimit();
+    response[0] = E_OK;
+    desk_getBusErrors(request[0], &response[1]);
     
-    host_response.command = (GET_DESK_LOWER_LIMIT | 0x80);
-    host_response.length = 3;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = ((limit & 0xFF00) >> 8); 
-    host_response.data[2] = (limit & 0x00FF);
-    host_calcChecksum(&host_response);
-
-    host_write(host_response);
+    return (1 + DESK_BUS_ERRORS);
 }
 
-static void respond_setDeskHalt()
+static uint8_t respond_setDeskHalt(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    uint16_t position;
-    struct host_data_packet host_response;
+    if ((desk_getOpMode() & OPERATION) != OPERATION) {
+        response[0] = E_DESK_NOT_READY;
+    } else if (desk_halt() == false) {
+        response[0] = E_DESK_BUSY;     // calibration or rescue
+    } else {
+        response[0] = E_OK;
+    }
     
-    position = desk_getPosition();
-    desk_setPosition(position);
+    return 1;
+}
+
+static uint8_t respond_setDeskStream(uint8_t arg, const uint8_t *request, uint8_t *response)
+{
+    if (request[0] > STREAM_CHANGE) {
+        response[0] = E_INVALID_DATA;
+        return 1;
+    }
     
-    host_response.command = (SET_DESK_HALT | 0x80);
-    host_response.length = 1;
-    host_response.data[0] = E_OK;
+    // every subscription gets the current telemetry with the next cycle, 
+    // even if nothing has changed since the last frame.
+    stream_mode = request[0];
+    stream_sequence = desk_getSequence();
+    stream_isPending = true;
     
-    host_calcChecksum(&host_response);
-    host_write(host_response);
+    response[0] = E_OK;
+    return 1;
 }
 
-static void respond_getDeskState()
+static uint8_t respond_setDeskWaypoint(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    uint8_t state;
-    struct host_data_packet host_response;
+    uint8_t state, count;
+    uint16_t position, dwell;
     
+    position = ((request[0] << 8) | request[1]);
+    dwell = ((request[2] << 8) | request[3]);   // lin cycles of 100ms
     state = desk_getOpMode();
     
-    host_response.command = (GET_DESK_STATE | 0x80);
-    host_response.length = 2;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = state; 
+    if ((state & OPERATION) != OPERATION) {
+        response[0] = E_DESK_NOT_READY;
+        return 1;
+    }
     
-    host_calcChecksum(&host_response);
-    host_write(host_response);
-}
-
-static void respond_getMotorProperty(uint8_t unit)
-{
-    uint8_t property = 0xFF;
-    struct host_data_packet host_response;
+    if ((state == OPERATION_BEGIN) || (state == OPERATION_RESCUE) || 
+        (state == OPERATION_CALIBRATING) || (state == OPERATION_CALIBRATING_DONE)) {
+        response[0] = E_DESK_BUSY;
+        return 1;
+    }
     
-    switch (unit)
-    {
-        case UNIT_LEFT:
-            host_response.command = (GET_MOTOR_LEFT_PROPERTY | 0x80);
-            property = motor_getProperty(UNIT_LEFT);
-            break;
-        case UNIT_RIGHT:
-            host_response.command = (GET_MOTOR_RIGHT_PROPERTY | 0x80);
-            property = motor_getProperty(UNIT_RIGHT);
-            break;
-        default: break;
-    }
-    
-    host_response.length = 2;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = property;
-    
-    host_calcChecksum(&host_response);
-    host_write(host_response);
-}
-
-static void respond_getMotorState(uint8_t unit)
-{
-    uint8_t state;
-    struct host_data_packet host_response;
+    if ((position < desk_getLowerLimit()) || (position > desk_getUpperLimit())) {
+        response[0] = E_INVALID_DATA;
+        return 1;
+    }
     
-    switch (unit)
-    {
-        case UNIT_LEFT: 
-            host_response.command = (GET_MOTOR_LEFT_STATE | 0x80);
-            state = motor_getState(UNIT_LEFT); 
-            break;
-        case UNIT_RIGHT:
-            host_response.command = (GET_MOTOR_RIGHT_STATE | 0x80);
-            state = motor_getState(UNIT_RIGHT); 
-            break;
-        default: break;
-    }
-    
-    host_response.length = 2;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = state;
-    
-    host_calcChecksum(&host_response);
-    host_write(host_response);
-}
-
-static void respond_getMotorPosition(uint8_t unit)
-{
-    uint16_t position;
-    struct host_data_packet host_response;
+    // queued behind the current move, motor_controller() runs the route 
+    // on its own. SET_DESK_POSITION or SET_DESK_HALT drop the rest of it.
+    count = desk_addWaypoint(position, dwell);
     
-    switch (unit)
-    {
-        case UNIT_LEFT: 
-            host_response.command = (GET_MOTOR_LEFT_POSITION | 0x80);
-            position = motor_getPosition(UNIT_LEFT); 
-            break;
-        case UNIT_RIGHT:
-            host_response.command = (GET_MOTOR_RIGHT_POSITION | 0x80);
-            position = motor_getPosition(UNIT_RIGHT); 
-            break;
-        default: break;
-    }
-    
-    host_response.length = 3;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = ((position & 0xFF00) >> 8);
-    host_response.data[2] = (position & 0xFF);
-    
-    host_calcChecksum(&host_response);
-    host_write(host_response);
-}
-
-static void respond_getMotorUpperLimit(uint8_t unit)
-{
-    uint16_t limit;
-    struct host_data_packet host_response;
+    if (count == 0) {
+        response[0] = E_DESK_QUEUE_FULL;
+        return 1;
+    }
     
-    switch (unit)
-    {
-        case UNIT_LEFT: 
-            host_response.command = (GET_MOTOR_LEFT_UPPER_LIMIT | 0x80);
-            limit = motor_getUpperLimit(UNIT_LEFT); 
-            break;
-        case UNIT_RIGHT:
-            host_response.command = (GET_MOTOR_RIGHT_UPPER_LIMIT | 0x80);
-            limit = motor_getUpperLimit(UNIT_RIGHT); 
-            break;
-        default: break;
-    }
-    
-    host_response.length = 3;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = ((limit & 0xFF00) >> 8);
-    host_response.data[2] = (limit & 0xFF);
-    
-    host_calcChecksum(&host_response);
-    host_write(host_response);
+    response[0] = E_OK;
+    response[1] = count;
+    return 2;
 }
 
-static void respond_getMotorLowerLimit(uint8_t unit)
+static void stream_process()
 {
-    uint16_t limit;
-    struct host_data_packet host_response;
+    uint8_t i, sequence;
+    uint16_t position;
+    struct host_data_packet *telemetry;
     
-    switch (unit)
-    {
-        case UNIT_LEFT: 
-            host_response.command = (GET_MOTOR_LEFT_LOWER_LIMIT | 0x80);
-            limit = motor_getLowerLimit(UNIT_LEFT); 
-            break;
-        case UNIT_RIGHT:
-            host_response.command = (GET_MOTOR_RIGHT_LOWER_LIMIT | 0x80);
-            limit = motor_getLowerLimit(UNIT_RIGHT); 
-            break;
-        default: break;
-    }
-    
-    host_response.length = 3;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = ((limit & 0xFF00) >> 8);
-    host_response.data[2] = (limit & 0xFF);
-    
-    host_calcChecksum(&host_response);
-    host_write(host_response);
-}
-
-static void respond_getMotorNodeId(uint8_t unit)
-{
-    uint8_t node_id;
-    struct host_data_packet host_response;
+    sequence = desk_getSequence();
     
-    switch (unit)
-    {
-        case UNIT_LEFT: 
-            host_response.command = (GET_MOTOR_LEFT_NODE_ID | 0x80);
-            node_id = motor_getNodeId(UNIT_LEFT); 
-            break;
-        case UNIT_RIGHT:
-            host_response.command = (GET_MOTOR_RIGHT_NODE_ID | 0x80);
-            node_id = motor_getNodeId(UNIT_RIGHT); 
-            break;
-        default: break;
-    }
-    
-    host_response.length = 2;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = node_id;
-    
-    host_calcChecksum(&host_response);
-    host_write(host_response);
-}
-
-static void respond_getMotorScanId(uint8_t unit)
-{
-    uint8_t scan_id;
-    struct host_data_packet host_response;
+    // one frame per finished lin cycle. if the tx queue is full, the 
+    // cycle is picked up with the next call.
+    if ((sequence == stream_sequence) || (host_isWritable() == false)) {
+        return;
+    }
+    stream_sequence = sequence;
     
-    switch (unit)
+    // the frame is built in its tx slot. if it is not sent, the slot is 
+    // reused by the next frame.
+    position = desk_getPosition();
+    telemetry = host_beginFrame(PUSH_DESK_TELEMETRY | 0x80);
+    telemetry->length = 6;
+    telemetry->data[0] = E_OK;
+    telemetry->data[1] = sequence;
+    telemetry->data[2] = desk_getOpMode();
+    telemetry->data[3] = ((position & 0xFF00) >> 8);
+    telemetry->data[4] = (position & 0xFF);
+    telemetry->data[5] = desk_getDrift();
+    
+    if ((stream_mode == STREAM_CHANGE) && (stream_isPending == false))
     {
-        case UNIT_LEFT: 
-            host_response.command = (GET_MOTOR_LEFT_SCAN_ID | 0x80);
-            scan_id = motor_getScanId(UNIT_LEFT); 
-            break;
-        case UNIT_RIGHT:
-            host_response.command = (GET_MOTOR_RIGHT_SCAN_ID | 0x80);
-            scan_id = motor_getScanId(UNIT_RIGHT); 
-            break;
-        default: break;
-    }
-    
-    host_response.length = 2;
-    host_response.data[0] = E_OK;
-    host_response.data[1] = scan_id;
-    
-    host_calcChecksum(&host_response);
-    host_write(host_response);
-}
-
-
-static void respond_callWatchdogEnable()
-{
-    struct host_data_packet host_response;
-    
-    wdt_enable();
+        // the sequence always differs, compare the payload behind it
+        for (i=0; i<sizeof(stream_payload); i++) {
+            if (telemetry->data[i + 2] != stream_payload[i]) {
+                break;
+            }
+        }
+        
+        if (i == sizeof(stream_payload)) {
+            return;
+        }
+    }
     
-    host_response.command = (CALL_WATCHDOG_ENABLE | 0x80);
-    host_response.length = 1;
-    host_response.data[0] = E_OK;
+    for (i=0; i<sizeof(stream_payload); i++) {
+        stream_payload[i] = telemetry->data[i + 2];
+    }
+    stream_isPending = false;
     
-    host_calcChecksum(&host_response);
-    host_write(host_response);
+    host_send(telemetry);
 }
 
-
-static void respond_callWatchdogDisable()
+static uint8_t respond_getMotorNodeId(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    struct host_data_packet host_response;
-    
-    wdt_disable();
-    
-    host_response.command = (CALL_WATCHDOG_DISABLE | 0x80);
-    host_response.length = 1;
-    host_response.data[0] = E_OK;
-    
-    host_calcChecksum(&host_response);
-    host_write(host_response);
+    response[0] = E_OK;
+    response[1] = motor_getNodeId(arg);
+    return 2;
 }
 
-
-static void respond_invalidCommand(uint8_t command)
+static uint8_t respond_callWatchdogEnable(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    struct host_data_packet host_response;
-    
-    host_response.command = (command | 0x80);
-    host_response.length = 1;
-    host_response.data[0] = E_INVALID_COMMAND;
+    wdt_enable();
     
-    host_calcChecksum(&host_response);
-    host_write(host_response);
+    response[0] = E_OK;
+    return 1;
 }
 
-static void respond_invalidChecksum(uint8_t command)
+static uint8_t respond_callWatchdogDisable(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    struct host_data_packet host_response;
-    
-    host_response.command = (command | 0x80);
-    host_response.length = 1;
-    host_response.data[0] = E_INVALID_CHECKSUM;
+    wdt_disable();
     
-    host_calcChecksum(&host_response);
-    host_write(host_response);
+    response[0] = E_OK;
+    return 1;
 }
 
-static void respond_invalidData(uint8_t command)
+static uint8_t respond_setHostBaudrate(uint8_t arg, const uint8_t *request, uint8_t *response)
 {
-    struct host_data_packet host_response;
+    if (request[0] >= BAUD_MAX) {
+        response[0] = E_INVALID_DATA;
+        return 1;
+    }
     
-    host_response.command = (command | 0x80);
-    host_response.length = 1;
-    host_response.data[0] = E_INVALID_DATA;
+    // acknowledged at the current rate. host_process() switches over once it 
+    // was sent, then the host has to confirm the new rate with any request.
+    host_setBaudrate(request[0]);
     
-    host_calcChecksum(&host_response);
-    host_write(host_response);
+    response[0] = E_OK;
+    return 1;
 }
@@ -0,0 +1,55 @@
+/*
+ * File:   nvm.c
+ * Author: sire
+ *
+ * Byte access to the 256 bytes of data eeprom. Unlike the storage area 
+ * flash, the eeprom needs no row erase and has a much higher endurance. 
+ */
+#include "nvm.h"
+
+
+uint8_t nvm_read(uint8_t address)
+{
+    while (nvm_isBusy() == true);
+    
+    NVMADRU = NVM_EEPROM_UPPER;
+    NVMADRH = NVM_EEPROM_HIGH;
+    NVMADRL = address;
+    NVMCON1bits.NVMCMD = NVM_CMD_READ;
+    NVMCON0bits.GO = 1;
+    
+    // the byte is in NVMDATL once GO clears
+    while (NVMCON0bits.GO == 1);
+    
+    return NVMDATL;
+}
+
+void nvm_write(uint8_t address, uint8_t data)
+{
+    uint8_t gie;
+    
+    while (nvm_isBusy() == true);
+    
+    NVMADRU = NVM_EEPROM_UPPER;
+    NVMADRH = NVM_EEPROM_HIGH;
+    NVMADRL = address;
+    NVMDATL = data;
+    NVMCON1bits.NVMCMD = NVM_CMD_WRITE;
+    
+    // unlock sequence must not be interrupted
+    gie = INTCONbits.GIE;
+    INTCONbits.GIE = 0;
+    NVMLOCK = 0x55;
+    NVMLOCK = 0xAA;
+    NVMCON0bits.GO = 1;
+    INTCONbits.GIE = gie;
+    
+    // GO stays set until the byte is written, the next access waits for it. 
+    // the command is set back to a read then, which needs no unlock.
+}
+
+bool nvm_isBusy()
+{
+    // a write takes a few milliseconds. the cpu keeps running meanwhile.
+    return (NVMCON0bits.GO == 1);
+}
@@ -0,0 +1,52 @@
+/* Microchip Technology Inc. and its subsidiaries.  You may use this software 
+ * and any derivatives exclusively with Microchip products. 
+ * 
+ * THIS SOFTWARE IS SUPPLIED BY MICROCHIP "AS IS".  NO WARRANTIES, WHETHER 
+ * EXPRESS, IMPLIED OR STATUTORY, APPLY TO THIS SOFTWARE, INCLUDING ANY IMPLIED 
+ * WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY, AND FITNESS FOR A 
+ * PARTICULAR PURPOSE, OR ITS INTERACTION WITH MICROCHIP PRODUCTS, COMBINATION 
+ * WITH ANY OTHER PRODUCTS, OR USE IN ANY APPLICATION. 
+ *
+ * IN NO EVENT WILL MICROCHIP BE LIABLE FOR ANY INDIRECT, SPECIAL, PUNITIVE, 
+ * INCIDENTAL OR CONSEQUENTIAL LOSS, DAMAGE, COST OR EXPENSE OF ANY KIND 
+ * WHATSOEVER RELATED TO THE SOFTWARE, HOWEVER CAUSED, EVEN IF MICROCHIP HAS 
+ * BEEN ADVISED OF THE POSSIBILITY OR THE DAMAGES ARE FORESEEABLE.  TO THE 
+ * FULLEST EXTENT ALLOWED BY LAW, MICROCHIP'S TOTAL LIABILITY ON ALL CLAIMS 
+ * IN ANY WAY RELATED TO THIS SOFTWARE WILL NOT EXCEED THE AMOUNT OF FEES, IF 
+ * ANY, THAT YOU HAVE PAID DIRECTLY TO MICROCHIP FOR THIS SOFTWARE.
+ *
+ * MICROCHIP PROVIDES THIS SOFTWARE CONDITIONALLY UPON YOUR ACCEPTANCE OF THESE 
+ * TERMS. 
+ */
+
+/* 
+ * File:   
+ * Author: 
+ * Comments:
+ * Revision history: 
+ */
+
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef NVM_H
+#define	NVM_H
+#include "mcc_generated_files/system/system.h"
+
+
+#define NVM_EEPROM_UPPER            0x38        /**< data eeprom is mapped to 0x380000..0x3800FF */
+#define NVM_EEPROM_HIGH             0x00
+#define NVM_EEPROM_SIZE             256
+
+#define NVM_CMD_READ                0b000       /**< NVMCON1.NVMCMD, read the byte at NVMADR into NVMDATL */
+#define NVM_CMD_WRITE               0b011       /**< NVMCON1.NVMCMD, write NVMDATL to NVMADR, needs the NVMLOCK unlock */
+
+#define NVM_ADDR_DESK_CACHE         0x00        /**< node discovery cache, see bekant.c */
+#define NVM_ADDR_DESK_TUNING        0x20        /**< learned stopping corrections, see bekant.c */
+
+
+uint8_t nvm_read(uint8_t address);
+void    nvm_write(uint8_t address, uint8_t data);
+bool    nvm_isBusy();
+
+
+#endif	/* NVM_H */
@@ -0,0 +1,933 @@
+/*
+ * File:   hal.c
+ * Author: sire
+ *
+ * Virtual peripherals for the native Linux build. The MCC driver API is
+ * implemented here with the same observable behaviour as the generated drivers
+ * (software ring buffers, callback order, TXIF/RCIF semantics), while the
+ * hardware underneath is replaced by a discrete event model on a virtual clock.
+ * Application code takes no virtual time; interrupts are serviced between two
+ * iterations of the main loop (see hal_idle()).
+ */
+#include <string.h>
+#include <time.h>
+#include "mcc_generated_files/system/system.h"
+#include "nvm.h"
+#include "hal.h"
+
+
+#define EUSART_RING_SIZE            8U          /**< same as EUSARTx_TX/RX_BUFFER_SIZE */
+#define EUSART_RING_MASK            (EUSART_RING_SIZE - 1U)
+#define EUSART_LINE_SIZE            64U         /**< bytes queued by a peer towards the pic */
+#define HAL_SCHEDULE_SLOTS          16
+
+#define TIME_NEVER                  UINT64_MAX
+
+#define HAL_UART_TOLERANCE          3U          /**< percent baud rate mismatch still received */
+
+#define MIN(a,b)                    (((a) < (b)) ? (a) : (b))
+#define MAX(a,b)                    (((a) > (b)) ? (a) : (b))
+
+
+struct hal_eusart {
+    uint16_t    brg;
+    bool        loopback;               /**< single wire bus: own tx is seen on rx */
+
+    bool        cren;
+    bool        sendb;
+    bool        txie;
+    bool        rcie;
+
+    int16_t     txreg;                  /**< -1 if empty (TXIF set) */
+    bool        tsr_break;
+    uint8_t     tsr_byte;
+    uint64_t    tsr_end;                /**< TIME_NEVER if shift register is idle */
+
+    uint8_t     line[EUSART_LINE_SIZE]; /**< bytes sent by the peer */
+    uint8_t     line_head, line_tail;
+    uint64_t    line_end;               /**< end of the byte currently on the wire */
+    uint64_t    line_next;              /**< earliest start of the first queued byte */
+
+    bool        rcif;
+    uint8_t     rcreg;
+    bool        ferr;
+
+    uint8_t     tx_ring[EUSART_RING_SIZE];
+    uint8_t     tx_head, tx_tail, tx_remaining;
+    uint8_t     rx_ring[EUSART_RING_SIZE];
+    uint8_t     rx_head, rx_tail, rx_count;
+
+    void        (*tx_cb)(void);
+    void        (*rx_cb)(void);
+    void        (*ferr_cb)(void);
+    void        (*oerr_cb)(void);
+
+    struct hal_uart_peer peer;
+};
+
+struct hal_timer {
+    bool        on;
+    bool        one_shot;
+    uint8_t     period;
+    uint64_t    elapsed;                /**< ns counted before the last start */
+    uint64_t    started;
+    void        (*cb)(void);
+};
+
+struct hal_event {
+    uint64_t    time;
+    void        (*callback)(void *ctx);
+    void        *ctx;
+};
+
+
+volatile __INTCONbits_t  INTCONbits;
+volatile __WDTCON0bits_t WDTCON0bits;
+volatile __PCON0bits_t   PCON0bits;
+volatile uint8_t         SP2BRGL;
+volatile uint8_t         SP2BRGH;
+
+static uint64_t             now;
+static struct hal_eusart    eusart[HAL_UART_MAX];
+static struct hal_timer     tmr0, tmr2;
+static struct hal_event     events[HAL_SCHEDULE_SLOTS];
+static struct hal_stats     stats;
+static uint8_t              eeprom[NVM_EEPROM_SIZE];
+static bool                 profiling = true;
+static bool                 wdt_running;
+
+// register view of EUSART1 for the direct LIN driver, see xc.h
+static volatile __RC1STAbits_t  lin_rc1sta;
+static volatile __TX1STAbits_t  lin_tx1sta;
+static volatile __PIE4bits_t    lin_pie4;
+static volatile uint8_t         lin_tx1reg;
+static bool                 lin_regsWritten;
+static bool                 lin_txregWritten;
+static uint64_t             wdt_cleared;
+static uint8_t              reset_pending;
+
+
+/**********************************************************
+ * MODEL
+ *********************************************************/
+static uint64_t eusart_bitTime(struct hal_eusart *u)
+{
+    if (u == &eusart[HAL_UART_HOST]) {
+        // host.c changes the rate at runtime
+        u->brg = (uint16_t) ((SP2BRGH << 8) | SP2BRGL);
+    }
+
+    // BRG16 = 1, BRGH = 1: baud = FOSC / (4 * (n + 1))
+    return ((4ULL * (u->brg + 1U) * 1000000000ULL) / HAL_FOSC);
+}
+
+static uint64_t eusart_peerBitTime(struct hal_eusart *u)
+{
+    if (u->peer.baud == 0) {
+        return eusart_bitTime(u);
+    }
+
+    return (1000000000ULL / u->peer.baud);
+}
+
+static bool eusart_peerMatches(struct hal_eusart *u)
+{
+    uint64_t own = eusart_bitTime(u), peer = eusart_peerBitTime(u);
+    uint64_t delta = (own > peer) ? (own - peer) : (peer - own);
+
+    return ((delta * 100U) <= (own * HAL_UART_TOLERANCE));
+}
+
+static void eusart_load(struct hal_eusart *u)
+{
+    if ((u->txreg >= 0) && (u->tsr_end == TIME_NEVER))
+    {
+        u->tsr_byte = (uint8_t) u->txreg;
+        u->tsr_break = u->sendb;
+        u->tsr_end = now + (eusart_bitTime(u) * (u->tsr_break ? HAL_UART_BREAK_BITS : HAL_UART_FRAME_BITS));
+        u->txreg = -1;
+    }
+}
+
+static void eusart_txregWrite(struct hal_eusart *u, uint8_t data)
+{
+    u->txreg = data;
+    eusart_load(u);
+}
+
+static void eusart_receive(struct hal_eusart *u, uint8_t unit, uint8_t data, bool framing)
+{
+    if (u->cren == false) {
+        return;
+    }
+
+    if (u->rcif == true) {
+        // previous byte was not serviced in time
+        stats.uart_rx_dropped[unit]++;
+    }
+
+    u->rcreg = data;
+    u->ferr = framing;
+    u->rcif = true;
+}
+
+/**
+ * Applies what the direct LIN driver has written to the EUSART1 registers 
+ * since the last access. Called before the model uses the state again.
+ */
+static void eusart1_commit(void)
+{
+    struct hal_eusart *u = &eusart[HAL_UART_LIN];
+
+    if (lin_regsWritten == true)
+    {
+        lin_regsWritten = false;
+        u->cren = lin_rc1sta.CREN;
+        u->sendb = lin_tx1sta.SENDB;
+        u->txie = lin_pie4.TX1IE;
+        u->rcie = lin_pie4.RC1IE;
+
+        if (u->cren == false) {
+            u->rcif = false;
+        }
+    }
+
+    if (lin_txregWritten == true)
+    {
+        lin_txregWritten = false;
+        eusart_txregWrite(u, lin_tx1reg);
+    }
+}
+
+static void eusart1_publish(void)
+{
+    struct hal_eusart *u = &eusart[HAL_UART_LIN];
+
+    lin_rc1sta.CREN = u->cren;
+    lin_rc1sta.FERR = (u->rcif && u->ferr);
+    lin_rc1sta.OERR = 0;
+    lin_tx1sta.SENDB = u->sendb;
+    lin_tx1sta.TRMT = (u->tsr_end == TIME_NEVER);
+    lin_pie4.TX1IE = u->txie;
+    lin_pie4.RC1IE = u->rcie;
+}
+
+static uint64_t timer_tick(uint16_t count)
+{
+    return (((uint64_t) count * 1000000000ULL) / HAL_LFINTOSC_FREQ);
+}
+
+static uint64_t timer_expiry(struct hal_timer *t)
+{
+    uint64_t period;
+
+    if (t->on == false) {
+        return TIME_NEVER;
+    }
+
+    period = timer_tick(t->period + 1U);
+
+    if (t->elapsed >= period) {
+        return t->started;
+    }
+
+    return (t->started + (period - t->elapsed));
+}
+
+static void timer_start(struct hal_timer *t)
+{
+    if (t->on == false) {
+        t->on = true;
+        t->started = now;
+    }
+}
+
+static void timer_stop(struct hal_timer *t)
+{
+    if (t->on == true) {
+        t->elapsed += (now - t->started);
+        t->on = false;
+    }
+}
+
+static uint8_t timer_get(struct hal_timer *t)
+{
+    uint64_t elapsed = t->elapsed + ((t->on == true) ? (now - t->started) : 0);
+    uint64_t count = (elapsed * HAL_LFINTOSC_FREQ) / 1000000000ULL;
+
+    return (uint8_t) MIN(count, t->period);
+}
+
+static void timer_set(struct hal_timer *t, uint8_t count)
+{
+    t->elapsed = timer_tick(count);
+    t->started = now;
+}
+
+static uint64_t wdt_expiry(void)
+{
+    // WDTSEN is a plain variable, the timer starts when the model notices it
+    if ((WDTCON0bits.WDTSEN == 0) || (reset_pending != HAL_RESET_NONE)) {
+        wdt_running = false;
+        return TIME_NEVER;
+    }
+
+    if (wdt_running == false) {
+        wdt_running = true;
+        wdt_cleared = now;
+    }
+
+    return (wdt_cleared + ((HAL_WDT_PRESCALER * 1000000000ULL) / HAL_LFINTOSC_FREQ));
+}
+
+static void hal_isr(uint8_t source, void (*handler)(void))
+{
+    struct timespec t0, t1;
+
+    stats.irq_count[source]++;
+
+    if (profiling == false) {
+        handler();
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    handler();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    stats.irq_timed[source]++;
+    stats.irq_ns[source] += (uint64_t) ((t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec));
+}
+
+/**
+ * Services pending interrupts in the same order as INTERRUPT_InterruptManager.
+ * Returns true if at least one handler was executed.
+ */
+static bool hal_dispatch(void)
+{
+    bool serviced = false;
+    bool pending = true;
+
+    while ((pending == true) && (INTCONbits.GIE == 1) && (INTCONbits.PEIE == 1))
+    {
+        eusart1_commit();
+
+        // the eusart handlers are called through the pointers like in 
+        // interrupt.c, the application may replace them
+        if ((tmr0.on == true) && (timer_expiry(&tmr0) <= now)) {
+            hal_isr(HAL_IRQ_TMR0, TMR0_ISR);
+        }
+        else if ((eusart[HAL_UART_LIN].txie == true) && (eusart[HAL_UART_LIN].txreg < 0)) {
+            hal_isr(HAL_IRQ_TX1, EUSART1_TxInterruptHandler);
+        }
+        else if ((eusart[HAL_UART_LIN].rcie == true) && (eusart[HAL_UART_LIN].rcif == true)) {
+            hal_isr(HAL_IRQ_RC1, EUSART1_RxInterruptHandler);
+        }
+        else if ((eusart[HAL_UART_HOST].txie == true) && (eusart[HAL_UART_HOST].txreg < 0)) {
+            hal_isr(HAL_IRQ_TX2, EUSART2_TxInterruptHandler);
+        }
+        else if ((eusart[HAL_UART_HOST].rcie == true) && (eusart[HAL_UART_HOST].rcif == true)) {
+            hal_isr(HAL_IRQ_RC2, EUSART2_RxInterruptHandler);
+        }
+        else if ((tmr2.on == true) && (timer_expiry(&tmr2) <= now)) {
+            hal_isr(HAL_IRQ_TMR2, TMR2_ISR);
+        }
+        else {
+            pending = false;
+        }
+
+        serviced |= pending;
+    }
+
+    eusart1_commit();
+
+    return serviced;
+}
+
+static uint64_t hal_nextEvent(void)
+{
+    uint8_t i;
+    uint64_t next = TIME_NEVER;
+    struct hal_eusart *u;
+
+    next = MIN(next, timer_expiry(&tmr0));
+    next = MIN(next, timer_expiry(&tmr2));
+    next = MIN(next, wdt_expiry());
+
+    for (i=0; i<HAL_UART_MAX; i++)
+    {
+        u = &eusart[i];
+        next = MIN(next, u->tsr_end);
+
+        if (u->line_end != TIME_NEVER) {
+            next = MIN(next, u->line_end);
+        } else if (u->line_head != u->line_tail) {
+            next = MIN(next, u->line_next);
+        }
+    }
+
+    for (i=0; i<HAL_SCHEDULE_SLOTS; i++) {
+        if (events[i].callback != NULL) {
+            next = MIN(next, events[i].time);
+        }
+    }
+
+    return next;
+}
+
+static void hal_process(void)
+{
+    uint8_t i, data;
+    bool brk;
+    struct hal_eusart *u;
+    void (*callback)(void *ctx);
+
+    if ((wdt_expiry() <= now) && (reset_pending == HAL_RESET_NONE)) {
+        reset_pending = HAL_RESET_WDT;
+        stats.wdt_resets++;
+    }
+
+    for (i=0; i<HAL_UART_MAX; i++)
+    {
+        u = &eusart[i];
+
+        if (u->tsr_end <= now)
+        {
+            // pic finished shifting out a byte
+            data = u->tsr_byte;
+            brk = u->tsr_break;
+            u->tsr_end = TIME_NEVER;
+            stats.uart_tx_bytes[i]++;
+
+            if (brk == true) {
+                u->sendb = false;
+            }
+
+            if (u->loopback == true) {
+                eusart_receive(u, i, (brk ? 0x00 : data), brk);
+            }
+
+            if ((u->peer.on_byte != NULL) && (eusart_peerMatches(u) == true)) {
+                u->peer.on_byte(u->peer.ctx, data, brk);
+            }
+
+            eusart_load(u);
+        }
+
+        if ((u->line_end != TIME_NEVER) && (u->line_end <= now))
+        {
+            // peer finished a byte
+            data = u->line[u->line_tail];
+            u->line_tail = (u->line_tail + 1U) % EUSART_LINE_SIZE;
+            u->line_end = TIME_NEVER;
+            u->line_next = now;
+            stats.uart_rx_bytes[i]++;
+
+            if (eusart_peerMatches(u) == true) {
+                eusart_receive(u, i, data, false);
+            } else {
+                eusart_receive(u, i, 0x00, true);
+            }
+        }
+
+        if ((u->line_end == TIME_NEVER) && (u->line_head != u->line_tail) && (u->line_next <= now)) {
+            u->line_end = now + (eusart_peerBitTime(u) * HAL_UART_FRAME_BITS);
+        }
+    }
+
+    for (i=0; i<HAL_SCHEDULE_SLOTS; i++)
+    {
+        if ((events[i].callback != NULL) && (events[i].time <= now))
+        {
+            callback = events[i].callback;
+            events[i].callback = NULL;
+            callback(events[i].ctx);
+        }
+    }
+}
+
+
+/**********************************************************
+ * SIMULATION INTERFACE
+ *********************************************************/
+void hal_reset(void)
+{
+    uint8_t i;
+
+    now = 0;
+    memset(&stats, 0, sizeof(stats));
+    memset(eeprom, 0xFF, sizeof(eeprom));
+
+    for (i=0; i<HAL_UART_MAX; i++) {
+        memset(&eusart[i].peer, 0, sizeof(struct hal_uart_peer));
+    }
+
+    hal_reboot(HAL_RESET_POR);
+}
+
+void hal_reboot(uint8_t cause)
+{
+    uint8_t i;
+    struct hal_uart_peer peer;
+
+    switch (cause)
+    {
+        case HAL_RESET_POR: PCON0 = 0x3C; break;
+        case HAL_RESET_BOR: PCON0bits.nBOR = 0; break;
+        case HAL_RESET_WDT: PCON0bits.nRWDT = 0; break;
+        default: break;
+    }
+
+    reset_pending = HAL_RESET_NONE;
+    wdt_running = false;
+    WDTCON0 = 0x00;
+    INTCONbits.GIE = 0;
+    INTCONbits.PEIE = 0;
+    memset(events, 0, sizeof(events));
+
+    for (i=0; i<HAL_UART_MAX; i++) {
+        peer = eusart[i].peer;
+        memset(&eusart[i], 0, sizeof(struct hal_eusart));
+        eusart[i].txreg = -1;
+        eusart[i].tsr_end = TIME_NEVER;
+        eusart[i].line_end = TIME_NEVER;
+        eusart[i].peer = peer;
+    }
+
+    eusart[HAL_UART_LIN].loopback = true;
+    lin_regsWritten = false;
+    lin_txregWritten = false;
+}
+
+uint64_t hal_now(void)
+{
+    return now;
+}
+
+uint8_t hal_resetPending(void)
+{
+    return reset_pending;
+}
+
+void hal_uart_attach(uint8_t unit, const struct hal_uart_peer *peer)
+{
+    if (unit < HAL_UART_MAX) {
+        if (peer != NULL) {
+            eusart[unit].peer = *peer;
+        } else {
+            memset(&eusart[unit].peer, 0, sizeof(struct hal_uart_peer));
+        }
+    }
+}
+
+void hal_uart_inject(uint8_t unit, const uint8_t *data, uint8_t length, uint32_t delay_us)
+{
+    uint8_t i, head;
+    struct hal_eusart *u;
+
+    if ((unit >= HAL_UART_MAX) || (data == NULL)) {
+        return;
+    }
+
+    u = &eusart[unit];
+
+    if ((u->line_end == TIME_NEVER) && (u->line_head == u->line_tail)) {
+        u->line_next = now + (delay_us * HAL_NS_PER_US);
+    }
+
+    for (i=0; i<length; i++)
+    {
+        head = (u->line_head + 1U) % EUSART_LINE_SIZE;
+
+        if (head == u->line_tail) {
+            break;      // line queue is full
+        }
+
+        u->line[u->line_head] = data[i];
+        u->line_head = head;
+    }
+}
+
+bool hal_uart_isIdle(uint8_t unit)
+{
+    struct hal_eusart *u = &eusart[unit];
+
+    return ((u->tsr_end == TIME_NEVER) && (u->txreg < 0) && (u->tx_remaining == EUSART_RING_SIZE) &&
+            (u->line_end == TIME_NEVER) && (u->line_head == u->line_tail));
+}
+
+void hal_uart_setPeerBaud(uint8_t unit, uint32_t baud)
+{
+    if (unit < HAL_UART_MAX) {
+        eusart[unit].peer.baud = baud;
+    }
+}
+
+uint32_t hal_uart_getBaud(uint8_t unit)
+{
+    return (uint32_t) (1000000000ULL / eusart_bitTime(&eusart[unit]));
+}
+
+void hal_idle(uint64_t deadline)
+{
+    uint64_t next;
+
+    if (hal_dispatch() == true) {
+        // give the main loop a chance to react first
+        return;
+    }
+
+    next = hal_nextEvent();
+
+    if (next > deadline) {
+        now = MAX(now, deadline);
+        return;
+    }
+
+    now = MAX(now, next);
+    hal_process();
+    hal_dispatch();
+}
+
+void hal_schedule(uint64_t time, void (*callback)(void *ctx), void *ctx)
+{
+    uint8_t i;
+
+    for (i=0; i<HAL_SCHEDULE_SLOTS; i++)
+    {
+        if (events[i].callback == NULL)
+        {
+            events[i].time = time;
+            events[i].callback = callback;
+            events[i].ctx = ctx;
+            break;
+        }
+    }
+}
+
+const struct hal_stats *hal_getStats(void)
+{
+    return &stats;
+}
+
+void hal_setProfiling(bool enable)
+{
+    profiling = enable;
+}
+
+/**********************************************************
+ * NVM (data eeprom, survives hal_reboot())
+ *********************************************************/
+uint8_t nvm_read(uint8_t address)
+{
+    return eeprom[address];
+}
+
+void nvm_write(uint8_t address, uint8_t data)
+{
+    eeprom[address] = data;
+    stats.nvm_writes++;
+}
+
+bool nvm_isBusy()
+{
+    return false;
+}
+
+void hal_eraseNvm(void)
+{
+    memset(eeprom, 0xFF, sizeof(eeprom));
+}
+
+void hal_clrwdt(void)
+{
+    wdt_cleared = now;
+}
+
+
+/**********************************************************
+ * SYSTEM
+ *********************************************************/
+void SYSTEM_Initialize(void)
+{
+    INTCONbits.GIE = 0;
+    INTCONbits.PEIE = 0;
+    WDTCON0 = 0x00;
+    PCON0bits.nRWDT = 1;        // WWDT_Initialize()
+    PCON0bits.nWDTWV = 1;
+
+    TMR0_Initialize();
+    TMR2_Initialize();
+    EUSART1_Initialize();
+    EUSART2_Initialize();
+}
+
+
+/**********************************************************
+ * EUSART1 / EUSART2
+ *********************************************************/
+static void eusart_initialize(struct hal_eusart *u, uint16_t brg)
+{
+    u->brg = brg;
+
+    if (u == &eusart[HAL_UART_HOST]) {
+        SP2BRGH = (uint8_t) (brg >> 8);
+        SP2BRGL = (uint8_t) brg;
+    }
+
+    u->cren = true;
+    u->sendb = false;
+    u->txie = false;
+    u->rcie = true;
+    u->tx_head = u->tx_tail = 0;
+    u->tx_remaining = EUSART_RING_SIZE;
+    u->rx_head = u->rx_tail = u->rx_count = 0;
+}
+
+static void eusart_write(struct hal_eusart *u, uint8_t data)
+{
+    if (u->txie == false)
+    {
+        eusart_txregWrite(u, data);
+    }
+    else if (u->tx_remaining > 0U)
+    {
+        u->tx_ring[u->tx_head] = data;
+        u->tx_head = (u->tx_head + 1U) & EUSART_RING_MASK;
+        u->tx_remaining--;
+    }
+    else
+    {
+        // overflow condition; tx buffer is full
+    }
+
+    u->txie = true;
+}
+
+static uint8_t eusart_read(struct hal_eusart *u)
+{
+    uint8_t data;
+
+    data = u->rx_ring[u->rx_tail];
+    u->rx_tail = (u->rx_tail + 1U) & EUSART_RING_MASK;
+
+    if (u->rx_count != 0U) {
+        u->rx_count--;
+    }
+
+    return data;
+}
+
+static void eusart_transmitIsr(struct hal_eusart *u)
+{
+    if (u->tx_remaining < EUSART_RING_SIZE)
+    {
+        eusart_txregWrite(u, u->tx_ring[u->tx_tail]);
+        u->tx_tail = (u->tx_tail + 1U) & EUSART_RING_MASK;
+        u->tx_remaining++;
+    }
+    else
+    {
+        u->txie = false;
+    }
+
+    if (u->tx_cb != NULL) {
+        u->tx_cb();
+    }
+}
+
+static void eusart_receiveIsr(struct hal_eusart *u)
+{
+    uint8_t head;
+
+    u->rcif = false;
+
+    if ((u->ferr == true) && (u->ferr_cb != NULL)) {
+        u->ferr_cb();
+    }
+
+    head = (u->rx_head + 1U) & EUSART_RING_MASK;
+
+    if (head != u->rx_tail)
+    {
+        u->rx_ring[u->rx_head] = u->rcreg;
+        u->rx_head = head;
+        u->rx_count++;
+    }
+
+    if (u->rx_cb != NULL) {
+        u->rx_cb();
+    }
+}
+
+#define HAL_EUSART_API(n, unit, brg_init)                                                               \
+    void    EUSART##n##_Initialize(void)            { eusart_initialize(&eusart[unit], brg_init);       \
+                                                      EUSART##n##_TxInterruptHandler = EUSART##n##_TransmitISR; \
+                                                      EUSART##n##_RxInterruptHandler = EUSART##n##_ReceiveISR; } \
+    void    EUSART##n##_Deinitialize(void)          { eusart[unit].txie = false; eusart[unit].rcie = false; } \
+    void    EUSART##n##_Enable(void)                { }                                                 \
+    void    EUSART##n##_Disable(void)               { }                                                 \
+    void    EUSART##n##_TransmitEnable(void)        { }                                                 \
+    void    EUSART##n##_TransmitDisable(void)       { }                                                 \
+    void    EUSART##n##_ReceiveEnable(void)         { eusart[unit].cren = true; }                       \
+    void    EUSART##n##_ReceiveDisable(void)        { eusart[unit].cren = false; eusart[unit].rcif = false; } \
+    void    EUSART##n##_TransmitInterruptEnable(void)   { eusart[unit].txie = true; }                   \
+    void    EUSART##n##_TransmitInterruptDisable(void)  { eusart[unit].txie = false; }                  \
+    void    EUSART##n##_ReceiveInterruptEnable(void)    { eusart[unit].rcie = true; }                   \
+    void    EUSART##n##_ReceiveInterruptDisable(void)   { eusart[unit].rcie = false; }                  \
+    void    EUSART##n##_SendBreakControlEnable(void)    { eusart[unit].sendb = true; }                  \
+    void    EUSART##n##_SendBreakControlDisable(void)   { eusart[unit].sendb = false; }                 \
+    void    EUSART##n##_AutoBaudSet(bool enable)        { (void) enable; }                              \
+    bool    EUSART##n##_AutoBaudQuery(void)             { return true; }                                \
+    bool    EUSART##n##_IsAutoBaudDetectOverflow(void)  { return false; }                               \
+    void    EUSART##n##_AutoBaudDetectOverflowReset(void) { }                                           \
+    bool    EUSART##n##_IsRxReady(void)             { return (eusart[unit].rx_count != 0U); }           \
+    bool    EUSART##n##_IsTxReady(void)             { return (eusart[unit].tx_remaining != 0U); }       \
+    bool    EUSART##n##_IsTxDone(void)              { return (eusart[unit].tsr_end == TIME_NEVER); }    \
+    size_t  EUSART##n##_ErrorGet(void)              { return (eusart[unit].ferr ? 0x02U : 0x00U); }     \
+    uint8_t EUSART##n##_Read(void)                  { return eusart_read(&eusart[unit]); }              \
+    void    EUSART##n##_Write(uint8_t txData)       { eusart_write(&eusart[unit], txData); }            \
+    void    EUSART##n##_TransmitISR(void)           { eusart_transmitIsr(&eusart[unit]); }              \
+    void    EUSART##n##_ReceiveISR(void)            { eusart_receiveIsr(&eusart[unit]); }               \
+    void    EUSART##n##_FramingErrorCallbackRegister(void (* cb)(void)) { if (cb != NULL) eusart[unit].ferr_cb = cb; } \
+    void    EUSART##n##_OverrunErrorCallbackRegister(void (* cb)(void)) { if (cb != NULL) eusart[unit].oerr_cb = cb; } \
+    void    EUSART##n##_TxCompleteCallbackRegister(void (* cb)(void))   { if (cb != NULL) eusart[unit].tx_cb = cb; }   \
+    void    EUSART##n##_RxCompleteCallbackRegister(void (* cb)(void))   { if (cb != NULL) eusart[unit].rx_cb = cb; }   \
+    void    (*EUSART##n##_TxInterruptHandler)(void) = EUSART##n##_TransmitISR;                          \
+    void    (*EUSART##n##_RxInterruptHandler)(void) = EUSART##n##_ReceiveISR;                           \
+                                                                                                        \
+    const uart_drv_interface_t UART##n = {                                                              \
+        .Initialize = &EUSART##n##_Initialize,                                                          \
+        .Deinitialize = &EUSART##n##_Deinitialize,                                                      \
+        .Read = &EUSART##n##_Read,                                                                      \
+        .Write = &EUSART##n##_Write,                                                                    \
+        .IsRxReady = &EUSART##n##_IsRxReady,                                                            \
+        .IsTxReady = &EUSART##n##_IsTxReady,                                                            \
+        .IsTxDone = &EUSART##n##_IsTxDone,                                                              \
+        .TransmitEnable = &EUSART##n##_TransmitEnable,                                                  \
+        .TransmitDisable = &EUSART##n##_TransmitDisable,                                                \
+        .AutoBaudSet = &EUSART##n##_AutoBaudSet,                                                        \
+        .AutoBaudQuery = &EUSART##n##_AutoBaudQuery,                                                    \
+        .ErrorGet = &EUSART##n##_ErrorGet,                                                              \
+        .TxCompleteCallbackRegister = &EUSART##n##_TxCompleteCallbackRegister,                          \
+        .RxCompleteCallbackRegister = &EUSART##n##_RxCompleteCallbackRegister,                          \
+        .FramingErrorCallbackRegister = &EUSART##n##_FramingErrorCallbackRegister,                      \
+        .OverrunErrorCallbackRegister = &EUSART##n##_OverrunErrorCallbackRegister,                      \
+    };
+
+HAL_EUSART_API(1, HAL_UART_LIN,  0x01A0)       // 19200 baud
+HAL_EUSART_API(2, HAL_UART_HOST, 0x0044)       // 115200 baud
+
+
+volatile __RC1STAbits_t *hal_rc1sta(void)
+{
+    eusart1_commit();
+    eusart1_publish();
+    lin_regsWritten = true;
+    return &lin_rc1sta;
+}
+
+volatile __TX1STAbits_t *hal_tx1sta(void)
+{
+    eusart1_commit();
+    eusart1_publish();
+    lin_regsWritten = true;
+    return &lin_tx1sta;
+}
+
+volatile __PIE4bits_t *hal_pie4(void)
+{
+    eusart1_commit();
+    eusart1_publish();
+    lin_regsWritten = true;
+    return &lin_pie4;
+}
+
+volatile uint8_t *hal_tx1reg(void)
+{
+    eusart1_commit();
+    lin_txregWritten = true;
+    return &lin_tx1reg;
+}
+
+uint8_t hal_rc1reg(void)
+{
+    eusart1_commit();
+    eusart[HAL_UART_LIN].rcif = false;
+    return eusart[HAL_UART_LIN].rcreg;
+}
+
+
+/**********************************************************
+ * TMR0 / TMR2
+ *********************************************************/
+void TMR0_Initialize(void)
+{
+    memset(&tmr0, 0, sizeof(tmr0));
+    tmr0.period = 0x9A;         // 5ms
+}
+
+void TMR0_Deinitialize(void)        { tmr0.on = false; }
+void TMR0_Start(void)               { timer_start(&tmr0); }
+void TMR0_Stop(void)                { timer_stop(&tmr0); }
+uint8_t TMR0_CounterGet(void)       { return timer_get(&tmr0); }
+void TMR0_CounterSet(uint8_t count) { timer_set(&tmr0, count); }
+void TMR0_PeriodSet(uint8_t period) { tmr0.period = period; }
+uint8_t TMR0_PeriodGet(void)        { return tmr0.period; }
+uint8_t TMR0_MaxCountGet(void)      { return TMR0_MAX_COUNT; }
+void TMR0_TMRInterruptEnable(void)  { }
+void TMR0_TMRInterruptDisable(void) { }
+
+void TMR0_ISR(void)
+{
+    tmr0.elapsed = 0;
+    tmr0.started = now;
+
+    if (tmr0.cb != NULL) {
+        tmr0.cb();
+    }
+}
+
+void TMR0_PeriodMatchCallbackRegister(void (* callbackHandler)(void))
+{
+    tmr0.cb = callbackHandler;
+}
+
+void TMR2_Initialize(void)
+{
+    memset(&tmr2, 0, sizeof(tmr2));
+    tmr2.period = 0x3D;         // 2ms
+    tmr2.one_shot = true;
+}
+
+void TMR2_Deinitialize(void)        { tmr2.on = false; }
+void TMR2_Start(void)               { timer_start(&tmr2); }
+void TMR2_Stop(void)                { timer_stop(&tmr2); }
+uint8_t TMR2_CounterGet(void)       { return timer_get(&tmr2); }
+void TMR2_CounterSet(uint8_t count) { timer_set(&tmr2, count); }
+void TMR2_PeriodSet(uint8_t period) { tmr2.period = period; }
+uint8_t TMR2_PeriodGet(void)        { return tmr2.period; }
+uint8_t TMR2_MaxCountGet(void)      { return TMR2_MAX_COUNT; }
+void TMR2_ModeSet(TMR2_HLT_MODE mode) { (void) mode; }
+void TMR2_ExtResetSourceSet(TMR2_HLT_EXT_RESET_SOURCE reset) { (void) reset; }
+void TMR2_TMRInterruptEnable(void)  { }
+void TMR2_TMRInterruptDisable(void) { }
+
+void TMR2_ISR(void)
+{
+    tmr2.elapsed = 0;
+    tmr2.started = now;
+
+    if (tmr2.one_shot == true) {
+        tmr2.on = false;
+    }
+
+    if (tmr2.cb != NULL) {
+        tmr2.cb();
+    }
+}
+
+void TMR2_PeriodMatchCallbackRegister(void (* callbackHandler)(void))
+{
+    tmr2.cb = callbackHandler;
+}
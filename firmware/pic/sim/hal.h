@@ -0,0 +1,93 @@
+/*
+ * File:   hal.h
+ * Author: sire
+ *
+ * Virtual peripherals for the native Linux build of the PIC firmware. 
+ * hal.c implements the MCC driver API (UART1/UART2, EUSARTx_*, TMR0_*, TMR2_*) 
+ * on top of a discrete event simulation with a virtual clock, so the unchanged 
+ * application code can be executed, traced and profiled without a desk.
+ */
+#ifndef HAL_H
+#define	HAL_H
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define HAL_NS_PER_US               1000ULL
+#define HAL_NS_PER_MS               1000000ULL
+
+#define HAL_LFINTOSC_FREQ           31000UL     /**< clock source of TMR0, TMR2 and WDT */
+#define HAL_WDT_PRESCALER           16384UL     /**< WDTCPS_9 in config_bits.c, ~528ms */
+#define HAL_FOSC                    32000000UL
+
+#define HAL_UART_BREAK_BITS         14          /**< start bit, 12 zero bits and a stop bit */
+#define HAL_UART_FRAME_BITS         10          /**< 8N1 */
+
+
+enum hal_uart_unit {
+    HAL_UART_LIN,       /**< EUSART1 (desk, single wire LIN bus) */
+    HAL_UART_HOST,      /**< EUSART2 (ESP32) */
+    HAL_UART_MAX
+};
+
+enum hal_reset_cause {
+    HAL_RESET_NONE,
+    HAL_RESET_POR,      /**< power cycle, ram content is lost */
+    HAL_RESET_BOR,      /**< brown-out, ram content is kept */
+    HAL_RESET_WDT       /**< watchdog timeout, ram content is kept */
+};
+
+enum hal_irq_source {
+    HAL_IRQ_TMR0,
+    HAL_IRQ_TX1,
+    HAL_IRQ_RC1,
+    HAL_IRQ_TX2,
+    HAL_IRQ_RC2,
+    HAL_IRQ_TMR2,
+    HAL_IRQ_MAX
+};
+
+/**
+ * A device connected to the other end of a UART. on_byte is called every time 
+ * the PIC has completely shifted out a byte (or a break) on the wire. If baud 
+ * is set and does not match the rate of the PIC, bytes are lost in both 
+ * directions and the PIC sees framing errors.
+ */
+struct hal_uart_peer {
+    void        *ctx;
+    void        (*on_byte)(void *ctx, uint8_t byte, bool is_break);
+    uint32_t    baud;       /**< 0 = always the rate of the pic */
+};
+
+struct hal_stats {
+    uint32_t    irq_count[HAL_IRQ_MAX];
+    uint32_t    irq_timed[HAL_IRQ_MAX];     /**< isr calls measured while profiling */
+    uint64_t    irq_ns[HAL_IRQ_MAX];        /**< host cpu time spent in the isr */
+    uint32_t    uart_tx_bytes[HAL_UART_MAX];
+    uint32_t    uart_rx_bytes[HAL_UART_MAX];
+    uint32_t    uart_rx_dropped[HAL_UART_MAX];
+    uint32_t    nvm_writes;
+    uint32_t    wdt_resets;
+};
+
+
+void        hal_reset(void);
+void        hal_reboot(uint8_t cause);          /**< reset of the pic, keeps the clock and the eeprom */
+uint8_t     hal_resetPending(void);             /**< watchdog timed out, the harness has to reboot */
+void        hal_eraseNvm(void);
+uint64_t    hal_now(void);
+
+void        hal_uart_attach(uint8_t unit, const struct hal_uart_peer *peer);
+void        hal_uart_inject(uint8_t unit, const uint8_t *data, uint8_t length, uint32_t delay_us);
+bool        hal_uart_isIdle(uint8_t unit);
+void        hal_uart_setPeerBaud(uint8_t unit, uint32_t baud);
+uint32_t    hal_uart_getBaud(uint8_t unit);
+
+void        hal_idle(uint64_t deadline);
+void        hal_schedule(uint64_t time, void (*callback)(void *ctx), void *ctx);
+
+const struct hal_stats *hal_getStats(void);
+void        hal_setProfiling(bool enable);      /**< measure the host cpu time of every isr */
+
+
+#endif	/* HAL_H */
@@ -0,0 +1,121 @@
+/*
+ * File:   xc.h
+ * Author: sire
+ *
+ * Stand-in for the XC8 device header when the firmware is built natively on 
+ * Linux. Only the special function registers and builtins which are touched 
+ * by the application code (main.c, bekant.c, lin.c, host.c) are provided here. 
+ * Everything the MCC drivers do with registers is modelled in hal.c instead.
+ *
+ * The EUSART1 registers used by the direct LIN driver (LIN_DIRECT_ISR) are 
+ * accessors into the model. Every access sees the current state, writes are 
+ * applied before the model continues.
+ */
+#ifndef XC_H
+#define	XC_H
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define __interrupt(...)
+#define __persistent                // every variable survives hal_reboot() here
+
+typedef struct {
+    uint8_t INTEDG  : 1;
+    uint8_t         : 5;
+    uint8_t PEIE    : 1;
+    uint8_t GIE     : 1;
+} __INTCONbits_t;
+
+typedef union {
+    struct {
+        uint8_t WDTSEN  : 1;
+        uint8_t WDTPS   : 5;
+        uint8_t         : 2;
+    };
+    uint8_t reg;
+} __WDTCON0bits_t;
+
+typedef union {
+    struct {
+        uint8_t nBOR    : 1;
+        uint8_t nPOR    : 1;
+        uint8_t nRI     : 1;
+        uint8_t nRMCLR  : 1;
+        uint8_t nRWDT   : 1;
+        uint8_t nWDTWV  : 1;
+        uint8_t STKUNF  : 1;
+        uint8_t STKOVF  : 1;
+    };
+    uint8_t reg;
+} __PCON0bits_t;
+
+typedef union {
+    struct {
+        uint8_t RX9D    : 1;
+        uint8_t OERR    : 1;
+        uint8_t FERR    : 1;
+        uint8_t ADDEN   : 1;
+        uint8_t CREN    : 1;
+        uint8_t SREN    : 1;
+        uint8_t RX9     : 1;
+        uint8_t SPEN    : 1;
+    };
+    uint8_t reg;
+} __RC1STAbits_t;
+
+typedef union {
+    struct {
+        uint8_t TX9D    : 1;
+        uint8_t TRMT    : 1;
+        uint8_t BRGH    : 1;
+        uint8_t SENDB   : 1;
+        uint8_t SYNC    : 1;
+        uint8_t TXEN    : 1;
+        uint8_t TX9     : 1;
+        uint8_t CSRC    : 1;
+    };
+    uint8_t reg;
+} __TX1STAbits_t;
+
+typedef union {
+    struct {
+        uint8_t RC1IE   : 1;
+        uint8_t TX1IE   : 1;
+        uint8_t         : 6;
+    };
+    uint8_t reg;
+} __PIE4bits_t;
+
+extern volatile __INTCONbits_t  INTCONbits;
+extern volatile __WDTCON0bits_t WDTCON0bits;
+extern volatile __PCON0bits_t   PCON0bits;
+extern volatile uint8_t         SP2BRGL;    // EUSART2 baud rate, see eusart_bitTime() in hal.c
+extern volatile uint8_t         SP2BRGH;
+
+volatile __RC1STAbits_t *hal_rc1sta(void);
+volatile __TX1STAbits_t *hal_tx1sta(void);
+volatile __PIE4bits_t   *hal_pie4(void);
+volatile uint8_t        *hal_tx1reg(void);
+uint8_t                 hal_rc1reg(void);
+
+#define RC1STAbits                  (*hal_rc1sta())
+#define TX1STAbits                  (*hal_tx1sta())
+#define PIE4bits                    (*hal_pie4())
+#define TX1REG                      (*hal_tx1reg())
+#define RC1REG                      (hal_rc1reg())     // read only, clears RCIF
+
+#define WDTCON0                     (WDTCON0bits.reg)
+#define PCON0                       (PCON0bits.reg)
+
+#define _PCON0_nBOR_MASK            0x01
+#define _PCON0_nPOR_MASK            0x02
+#define _PCON0_nRWDT_MASK           0x10
+
+void hal_clrwdt(void);
+
+#define CLRWDT()                    hal_clrwdt()
+#define NOP()                       do { } while (0)
+
+
+#endif	/* XC_H */
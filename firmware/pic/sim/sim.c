@@ -0,0 +1,870 @@
+/*
+ * File:   sim.c
+ * Author: sire
+ *
+ * Native Linux harness for the PIC firmware. Executes app_init()/app_process()
+ * from main.c against the virtual peripherals in hal.c and plays a script of
+ * host requests on EUSART2. Every response of the firmware is printed with its
+ * virtual timestamp, so runs can be diffed and timed.
+ *
+ * Script syntax (one command per line, '#' starts a comment):
+ *   run  <ms>                  advance the virtual clock
+ *   send <cmd> [data ...]      send a framed host request (hex bytes)
+ *   raw  <byte> [byte ...]     inject raw bytes on the host uart (hex)
+ *   wait                       run until the pending response was received
+ *   stats                      print interrupt and uart statistics
+ *   ready                      run until the desk reached OPERATION_NORMAL
+ *   reboot                     power cycle controller and desk, the eeprom is kept
+ *   brownout                   brown-out reset of the controller, the desk keeps running
+ *   hang <ms>                  stall the main loop, interrupts are still served
+ *   erase                      erase the eeprom
+ *
+ *   move  <position> [<ms> <position>]
+ *                              move the virtual desk (decimal, 0.1 mm) and report
+ *                              time-to-target, final error and overshoot. the
+ *                              second target is sent <ms> after the first one
+ *   route <position> <ms> [<position> <ms> ...]
+ *                              queue waypoints with the time to rest at each of
+ *                              them and report when the desk reached them
+ *   bench <count> [seed]       run <count> random moves and print the totals
+ *   expect <error> [overshoot] fail the run (exit status 1) if a later move or bench
+ *                              move rests further off its target or travels further
+ *                              beyond it, 0 = off
+ *   block <left|right> <ms>    block a motor, 0 = until the next stop command
+ *   drift <left|right> <factor> scale the speed of a motor (1.0 = nominal)
+ *   load <share>               load on the desk, changes the braking force by +share 
+ *                              going up and -share going down (0 = nominal)
+ *   noise <permille> [seed]    drop responses of the virtual desk
+ *   schedule <classic|lean>    select the lin schedule of desk_operation()
+ *   events <on|off>            start the next lin slot as soon as a frame completed
+ *   scan <full|quick>          startup scan of all node counters or up to the last motor
+ *   pacing <fixed|adaptive>    startup steps on the 5ms tick or as soon as the frame completed
+ *   pipe <count> [depth] [cmd] send <count> sequenced requests (default GET_DESK_POSITION)
+ *                              with up to <depth> in flight and print the throughput
+ *   baud <rate|auto>           baud rate of the host, auto = always the rate of the pic
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "hal.h"
+#include "host.h"
+#include "bekant.h"
+#include "lin.h"
+#include "vdesk.h"
+
+
+#define SIM_LINE_LEN                256
+#define SIM_FRAME_LEN               (DATA_BUFFER_SIZE + 4)
+#define SIM_WAIT_TIMEOUT            (1000ULL * HAL_NS_PER_MS)
+#define SIM_MOVE_TIMEOUT            (60000ULL * HAL_NS_PER_MS)
+#define SIM_START_POSITION          2000
+#define SIM_BENCH_MARGIN            (2 * DESK_STOPPING_DISTANCE)
+#define SIM_PIPE_TIMEOUT            (60000ULL * HAL_NS_PER_MS)
+#define SIM_ROUTE_LEN               8           /**< more than the pic queues, to see it reject them */
+#define SIM_CYCLE_MS                100
+
+
+struct sim_move {
+    uint8_t     ack;                /**< error code of the SET_DESK_POSITION response */
+    bool        done;               /**< desk returned to OPERATION_NORMAL and both motors rest */
+    uint64_t    duration;           /**< from the acknowledge to standstill */
+    double      error;              /**< final position minus target */
+    double      overshoot;          /**< travel beyond the target, both motors */
+};
+
+
+void app_init();
+void app_process();
+
+static void sim_step(uint64_t deadline);
+static void sim_reboot(uint8_t cause);
+static void sim_run(uint64_t duration);
+static void sim_send(uint8_t command, const uint8_t *data, uint8_t length);
+static void sim_wait(void);
+static bool sim_waitReady(void);
+static void sim_move(uint16_t position, uint32_t retarget_ms, uint16_t retarget, struct sim_move *result);
+static void sim_route(uint8_t count, const uint16_t *position, const uint32_t *dwell_ms);
+static void sim_bench(uint32_t count, uint32_t seed);
+static bool sim_expect(const struct sim_move *move);
+static void sim_pipe(uint32_t count, uint8_t depth, uint8_t command);
+static uint8_t sim_parseUnit(const char *token);
+static void sim_printStats(void);
+static void sim_printFrame(uint64_t time, const char *prefix, const uint8_t *frame, uint8_t length);
+
+static void cb_host_byte(void *ctx, uint8_t byte, bool is_break);
+static void cb_lin_byte(void *ctx, uint8_t byte, bool is_break);
+
+
+static bool     sim_verbose;
+static bool     sim_quiet;          /**< suppress the per-frame output during bench */
+static uint8_t  sim_responses;
+static uint8_t  sim_response[SIM_FRAME_LEN];
+static uint32_t sim_pushes;         /**< unsolicited telemetry frames */
+static uint32_t sim_sequenced;      /**< responses to sequenced requests */
+static uint32_t sim_outOfOrder;     /**< sequenced responses with an unexpected sequence number */
+static uint8_t  sim_sequence;       /**< next sequence number expected */
+static double   sim_errorLimit;     /**< |error| a move may rest off its target, 0 = any */
+static double   sim_overshootLimit; /**< travel a move may go beyond its target, 0 = any */
+static uint32_t sim_errorCount;     /**< moves beyond sim_errorLimit or sim_overshootLimit */
+
+static uint8_t  host_frame[SIM_FRAME_LEN];
+static uint8_t  host_frameCount;
+
+static uint8_t  lin_frame[SIM_FRAME_LEN];
+static uint8_t  lin_frameCount;
+static uint64_t lin_frameStart;
+
+
+int main(int argc, char **argv)
+{
+    FILE *script = stdin;
+    char line[SIM_LINE_LEN];
+    char *token, *end;
+    uint8_t bytes[SIM_FRAME_LEN], count;
+    struct hal_uart_peer host_peer = { NULL, cb_host_byte };
+    struct hal_uart_peer lin_peer = { NULL, cb_lin_byte };
+    struct timespec t0, t1;
+    uint16_t position;
+    uint64_t start;
+    unsigned long value;
+    int i;
+
+    for (i=1; i<argc; i++)
+    {
+        if (strcmp(argv[i], "-v") == 0) {
+            sim_verbose = true;
+        } else if ((script = fopen(argv[i], "r")) == NULL) {
+            fprintf(stderr, "usage: %s [-v] [script]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    hal_reset();
+    hal_uart_attach(HAL_UART_HOST, &host_peer);
+    hal_uart_attach(HAL_UART_LIN, &lin_peer);
+    vdesk_init(SIM_START_POSITION);
+    app_init();
+
+    while (fgets(line, sizeof(line), script) != NULL)
+    {
+        if ((token = strchr(line, '#')) != NULL) {
+            *token = '\0';
+        }
+
+        if ((token = strtok(line, " \t\r\n")) == NULL) {
+            continue;
+        }
+
+        if (strcmp(token, "run") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+            sim_run((token != NULL) ? (strtoull(token, NULL, 10) * HAL_NS_PER_MS) : 0);
+        }
+        else if ((strcmp(token, "send") == 0) || (strcmp(token, "raw") == 0))
+        {
+            bool framed = (token[0] == 's');
+
+            for (count=0; (token = strtok(NULL, " \t\r\n")) != NULL && (count < sizeof(bytes)); count++) {
+                bytes[count] = (uint8_t) strtoul(token, &end, 16);
+            }
+
+            if (framed && (count > 0)) {
+                sim_send(bytes[0], &bytes[1], (count - 1));
+            } else {
+                hal_uart_inject(HAL_UART_HOST, bytes, count, 0);
+            }
+        }
+        else if (strcmp(token, "wait") == 0)
+        {
+            sim_wait();
+        }
+        else if (strcmp(token, "stats") == 0)
+        {
+            sim_printStats();
+        }
+        else if (strcmp(token, "ready") == 0)
+        {
+            start = hal_now();
+
+            if (sim_waitReady() == true) {
+                printf("%10.3f  ready after %.1f ms\n", (double) hal_now() / HAL_NS_PER_MS, (double) (hal_now() - start) / HAL_NS_PER_MS);
+            } else {
+                printf("%10.3f  ready timeout\n", (double) hal_now() / HAL_NS_PER_MS);
+            }
+        }
+        else if (strcmp(token, "reboot") == 0)
+        {
+            sim_reboot(HAL_RESET_POR);
+        }
+        else if (strcmp(token, "brownout") == 0)
+        {
+            sim_reboot(HAL_RESET_BOR);
+        }
+        else if (strcmp(token, "hang") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+            start = hal_now() + ((token != NULL) ? (strtoull(token, NULL, 10) * HAL_NS_PER_MS) : 0);
+
+            while ((hal_now() < start) && (hal_resetPending() == HAL_RESET_NONE)) {
+                hal_idle(start);
+            }
+
+            if (hal_resetPending() != HAL_RESET_NONE) {
+                sim_reboot(hal_resetPending());
+            }
+        }
+        else if (strcmp(token, "erase") == 0)
+        {
+            hal_eraseNvm();
+        }
+        else if (strcmp(token, "move") == 0)
+        {
+            struct sim_move move;
+
+            uint32_t retarget_ms = 0;
+
+            token = strtok(NULL, " \t\r\n");
+            position = (token != NULL) ? (uint16_t) strtoul(token, NULL, 10) : 0;
+
+            if ((token = strtok(NULL, " \t\r\n")) != NULL) {
+                retarget_ms = strtoul(token, NULL, 10);
+                token = strtok(NULL, " \t\r\n");
+                value = (token != NULL) ? strtoul(token, NULL, 10) : position;
+            } else {
+                value = position;
+            }
+
+            sim_move(position, retarget_ms, (uint16_t) value, &move);
+            position = (uint16_t) value;
+
+            if (move.ack != E_OK) {
+                printf("%10.3f  move %u rejected (%02X)\n", (double) hal_now() / HAL_NS_PER_MS, position, move.ack);
+            } else if (move.done == false) {
+                printf("%10.3f  move %u timeout\n", (double) hal_now() / HAL_NS_PER_MS, position);
+            } else {
+                printf("%10.3f  move %u in %.1f ms, error %+.1f, overshoot %.1f\n", (double) hal_now() / HAL_NS_PER_MS,
+                        position, (double) move.duration / HAL_NS_PER_MS, move.error, move.overshoot);
+            }
+
+            if (sim_expect(&move) == false) {
+                printf("%10.3f  expect failed, error beyond %.1f or overshoot beyond %.1f\n", (double) hal_now() / HAL_NS_PER_MS, 
+                        sim_errorLimit, sim_overshootLimit);
+            }
+        }
+        else if (strcmp(token, "route") == 0)
+        {
+            uint16_t route[SIM_ROUTE_LEN];
+            uint32_t dwell[SIM_ROUTE_LEN];
+
+            for (count=0; (count < SIM_ROUTE_LEN) && ((token = strtok(NULL, " \t\r\n")) != NULL); count++) {
+                route[count] = (uint16_t) strtoul(token, NULL, 10);
+                token = strtok(NULL, " \t\r\n");
+                dwell[count] = (token != NULL) ? strtoul(token, NULL, 10) : 0;
+            }
+
+            sim_route(count, route, dwell);
+        }
+        else if (strcmp(token, "pipe") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+            value = (token != NULL) ? strtoul(token, NULL, 10) : 100;
+            token = strtok(NULL, " \t\r\n");
+            count = (token != NULL) ? (uint8_t) strtoul(token, NULL, 10) : HOST_RX_QUEUE_LEN;
+            token = strtok(NULL, " \t\r\n");
+            sim_pipe(value, MAX(count, 1), (token != NULL) ? (uint8_t) strtoul(token, NULL, 16) : GET_DESK_POSITION);
+        }
+        else if (strcmp(token, "baud") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+            value = ((token != NULL) && (strcmp(token, "auto") != 0)) ? strtoul(token, NULL, 10) : 0;
+            hal_uart_setPeerBaud(HAL_UART_HOST, value);
+            printf("%10.3f  baud host %lu, pic %u\n", (double) hal_now() / HAL_NS_PER_MS, value, hal_uart_getBaud(HAL_UART_HOST));
+        }
+        else if (strcmp(token, "bench") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+            value = (token != NULL) ? strtoul(token, NULL, 10) : 100;
+            token = strtok(NULL, " \t\r\n");
+            sim_bench(value, (token != NULL) ? strtoul(token, NULL, 10) : 1);
+        }
+        else if ((strcmp(token, "block") == 0) || (strcmp(token, "drift") == 0))
+        {
+            bool block = (token[0] == 'b');
+            uint8_t unit = sim_parseUnit(strtok(NULL, " \t\r\n"));
+
+            if ((unit < VDESK_UNITS) && ((token = strtok(NULL, " \t\r\n")) != NULL))
+            {
+                if (block == true) {
+                    vdesk_block(unit, strtoul(token, NULL, 10));
+                } else {
+                    vdesk_setDrift(unit, strtod(token, NULL));
+                }
+            } else {
+                fprintf(stderr, "usage: %s <left|right> <value>\n", block ? "block" : "drift");
+            }
+        }
+        else if (strcmp(token, "load") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+            vdesk_setLoad((token != NULL) ? strtod(token, NULL) : 0);
+        }
+        else if (strcmp(token, "schedule") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+
+            if ((token != NULL) && (strcmp(token, "classic") == 0)) {
+                desk_setSchedule(DESK_SCHEDULE_CLASSIC);
+            } else if ((token != NULL) && (strcmp(token, "lean") == 0)) {
+                desk_setSchedule(DESK_SCHEDULE_LEAN);
+            } else {
+                fprintf(stderr, "usage: schedule <classic|lean>\n");
+            }
+        }
+        else if (strcmp(token, "events") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+            desk_setEventDriven((token != NULL) && (strcmp(token, "on") == 0));
+        }
+        else if (strcmp(token, "scan") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+            desk_setQuickScan((token != NULL) && (strcmp(token, "quick") == 0));
+        }
+        else if (strcmp(token, "pacing") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+            desk_setAdaptiveStartup((token != NULL) && (strcmp(token, "adaptive") == 0));
+        }
+        else if (strcmp(token, "expect") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+            sim_errorLimit = (token != NULL) ? strtod(token, NULL) : 0;
+            token = strtok(NULL, " \t\r\n");
+            sim_overshootLimit = (token != NULL) ? strtod(token, NULL) : 0;
+        }
+        else if (strcmp(token, "noise") == 0)
+        {
+            token = strtok(NULL, " \t\r\n");
+            value = (token != NULL) ? strtoul(token, NULL, 10) : 0;
+            token = strtok(NULL, " \t\r\n");
+            vdesk_setNoise(value, (token != NULL) ? strtoul(token, NULL, 10) : 0);
+        }
+        else
+        {
+            fprintf(stderr, "unknown command '%s'\n", token);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (sim_verbose == true)
+    {
+        printf("# simulated %.3f ms in %.3f ms wall time\n",
+                (double) hal_now() / HAL_NS_PER_MS,
+                ((t1.tv_sec - t0.tv_sec) * 1e3) + ((t1.tv_nsec - t0.tv_nsec) / 1e6));
+    }
+
+    return (sim_errorCount > 0) ? 1 : 0;
+}
+
+
+static void sim_step(uint64_t deadline)
+{
+    app_process();
+    hal_idle(deadline);
+
+    if (hal_resetPending() != HAL_RESET_NONE) {
+        sim_reboot(hal_resetPending());
+    }
+}
+
+static void sim_reboot(uint8_t cause)
+{
+    const char *name[] = { "", "power-on", "brown-out", "watchdog" };
+
+    if (sim_quiet == false) {
+        printf("%10.3f  %s reset\n", (double) hal_now() / HAL_NS_PER_MS, name[cause]);
+    }
+
+    hal_reboot(cause);
+
+    if (cause == HAL_RESET_POR) {
+        vdesk_powerCycle();
+    }
+
+    app_init();
+}
+
+static void sim_run(uint64_t duration)
+{
+    uint64_t deadline = hal_now() + duration;
+
+    while (hal_now() < deadline)
+    {
+        sim_step(deadline);
+    }
+
+    app_process();
+}
+
+static void sim_send(uint8_t command, const uint8_t *data, uint8_t length)
+{
+    uint8_t i, frame[SIM_FRAME_LEN + 4];
+
+    frame[0] = HOST_STX;
+    frame[1] = command;
+    frame[2] = length;
+    frame[length + 3] = (HOST_STX ^ command ^ length);
+
+    for (i=0; i<length; i++) {
+        frame[i + 3] = data[i];
+        frame[length + 3] ^= data[i];
+    }
+
+    sim_responses = 0;
+    hal_uart_inject(HAL_UART_HOST, frame, (length + 4), 0);
+}
+
+static void sim_wait(void)
+{
+    uint64_t deadline = hal_now() + SIM_WAIT_TIMEOUT;
+
+    while ((sim_responses == 0) && (hal_now() < deadline))
+    {
+        sim_step(deadline);
+    }
+
+    if (sim_responses == 0) {
+        printf("%10.3f  host <- timeout\n", (double) hal_now() / HAL_NS_PER_MS);
+    }
+}
+
+static bool sim_waitReady(void)
+{
+    uint64_t deadline = hal_now() + SIM_MOVE_TIMEOUT;
+
+    while ((desk_getOpMode() != OPERATION_NORMAL) && (hal_now() < deadline))
+    {
+        sim_step(deadline);
+    }
+
+    return (desk_getOpMode() == OPERATION_NORMAL);
+}
+
+static void sim_move(uint16_t position, uint32_t retarget_ms, uint16_t retarget, struct sim_move *result)
+{
+    uint8_t i, data[2];
+    uint64_t start, deadline, switchover;
+    bool up, started = false;
+    double beyond;
+    struct vmotor *m;
+
+    memset(result, 0, sizeof(*result));
+    result->ack = E_DESK_BUSY;
+
+    if (sim_waitReady() == false) {
+        return;
+    }
+
+    data[0] = (position >> 8);
+    data[1] = (position & 0xFF);
+    up = (position > desk_getPosition());
+
+    sim_send(SET_DESK_POSITION, data, 2);
+    sim_wait();
+
+    result->ack = (sim_responses > 0) ? sim_response[3] : E_DESK_BUSY;
+
+    if (result->ack != E_OK) {
+        return;
+    }
+
+    start = hal_now();
+    deadline = start + SIM_MOVE_TIMEOUT;
+    switchover = (retarget_ms > 0) ? (start + (retarget_ms * HAL_NS_PER_MS)) : 0;
+    vdesk_update();
+
+    for (i=0; i<VDESK_UNITS; i++) {
+        m = vdesk_getMotor(i);
+        m->peak_low = m->position;
+        m->peak_high = m->position;
+    }
+
+    while (hal_now() < deadline)
+    {
+        if (switchover != 0)
+        {
+            sim_step(switchover);
+
+            if (hal_now() < switchover) {
+                continue;
+            }
+
+            // the second target counts from here, so do the travel extremes
+            switchover = 0;
+            position = retarget;
+            up = (position > desk_getPosition());
+            data[0] = (position >> 8);
+            data[1] = (position & 0xFF);
+
+            sim_send(SET_DESK_POSITION, data, 2);
+            sim_wait();
+
+            result->ack = (sim_responses > 0) ? sim_response[3] : E_DESK_BUSY;
+
+            if (result->ack != E_OK) {
+                return;
+            }
+
+            vdesk_update();
+
+            for (i=0; i<VDESK_UNITS; i++) {
+                m = vdesk_getMotor(i);
+                m->peak_low = m->position;
+                m->peak_high = m->position;
+            }
+        }
+
+        sim_step(deadline);
+
+        if (desk_getOpMode() != OPERATION_NORMAL) {
+            started = true;
+        } else if ((started == true) && (vdesk_isResting() == true)) {
+            result->done = true;
+            break;
+        }
+    }
+
+    for (i=0; i<VDESK_UNITS; i++) {
+        m = vdesk_getMotor(i);
+        beyond = up ? (m->peak_high - position) : (position - m->peak_low);
+        result->overshoot = MAX(result->overshoot, beyond);
+    }
+
+    result->duration = hal_now() - start;
+    result->error = vdesk_getMotor(VDESK_LEFT)->position - position;
+}
+
+static void sim_route(uint8_t count, const uint16_t *position, const uint32_t *dwell_ms)
+{
+    uint8_t i, queued = 0, sequence, data[4];
+    uint16_t dwell;
+    uint64_t start, deadline;
+    int leg = -1, current;
+    bool arrived = true;
+
+    if (sim_waitReady() == false) {
+        printf("%10.3f  route timeout\n", (double) hal_now() / HAL_NS_PER_MS);
+        return;
+    }
+
+    // all waypoints go out at once, the pic runs the route on its own
+    for (i=0; i<count; i++)
+    {
+        dwell = (uint16_t) (dwell_ms[i] / SIM_CYCLE_MS);
+        data[0] = (position[i] >> 8);
+        data[1] = (position[i] & 0xFF);
+        data[2] = (dwell >> 8);
+        data[3] = (dwell & 0xFF);
+
+        sim_send(SET_DESK_WAYPOINT, data, 4);
+        sim_wait();
+
+        if ((sim_responses > 0) && (sim_response[3] == E_OK)) {
+            queued++;
+        }
+    }
+
+    start = hal_now();
+    deadline = start + SIM_MOVE_TIMEOUT;
+
+    // the count of waypoints is published with the cycle, wait for one
+    sequence = desk_getSequence();
+
+    while ((desk_getSequence() == sequence) && (hal_now() < deadline)) {
+        sim_step(deadline);
+    }
+
+    while (hal_now() < deadline)
+    {
+        // a waypoint is reached once the desk rests there or the next one is taken up
+        current = (queued - desk_getWaypoints() - 1);
+
+        if ((arrived == false) && ((current != leg) || (desk_getOpMode() == OPERATION_DWELLING) || (desk_getOpMode() == OPERATION_NORMAL)))
+        {
+            arrived = true;
+            vdesk_update();
+            printf("%10.3f  waypoint %u in %.1f ms, error %+.1f\n", (double) hal_now() / HAL_NS_PER_MS, position[leg],
+                    (double) (hal_now() - start) / HAL_NS_PER_MS, vdesk_getMotor(VDESK_LEFT)->position - position[leg]);
+        }
+
+        if (current != leg) {
+            leg = current;
+            arrived = false;
+            start = hal_now();
+        }
+
+        if ((arrived == true) && (leg == (queued - 1)) && (desk_getOpMode() == OPERATION_NORMAL) && (vdesk_isResting() == true)) {
+            printf("%10.3f  route done\n", (double) hal_now() / HAL_NS_PER_MS);
+            return;
+        }
+
+        sim_step(deadline);
+    }
+
+    printf("%10.3f  route timeout\n", (double) hal_now() / HAL_NS_PER_MS);
+}
+
+static void sim_bench(uint32_t count, uint32_t seed)
+{
+    struct sim_move move;
+    struct timespec t0, t1;
+    uint16_t lower, upper, position;
+    uint32_t i, moves = 0, failed = 0, beyond = 0;
+    double duration = 0, duration_max = 0, error = 0, error_max = 0, overshoot = 0, overshoot_max = 0;
+    double wall;
+
+    srand(seed);
+
+    if (sim_waitReady() == false) {
+        printf("# bench: desk not ready\n");
+        return;
+    }
+
+    lower = desk_getLowerLimit() + SIM_BENCH_MARGIN;
+    upper = desk_getUpperLimit() - SIM_BENCH_MARGIN;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    sim_quiet = true;
+    hal_setProfiling(false);
+
+    for (i=0; i<count; i++)
+    {
+        do {
+            position = lower + (rand() % (upper - lower));
+        } while (abs((int) position - (int) desk_getPosition()) <= SIM_BENCH_MARGIN);
+
+        sim_move(position, 0, position, &move);
+
+        if ((move.ack != E_OK) || (move.done == false)) {
+            failed++;
+            continue;
+        }
+
+        if (sim_expect(&move) == false) {
+            beyond++;
+        }
+
+        moves++;
+        duration += (double) move.duration / HAL_NS_PER_MS;
+        duration_max = MAX(duration_max, (double) move.duration / HAL_NS_PER_MS);
+        error += fabs(move.error);
+        error_max = MAX(error_max, fabs(move.error));
+        overshoot += move.overshoot;
+        overshoot_max = MAX(overshoot_max, move.overshoot);
+    }
+
+    sim_quiet = false;
+    hal_setProfiling(true);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    wall = ((t1.tv_sec - t0.tv_sec) * 1e3) + ((t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+    if (moves == 0) {
+        moves = 1;      // only failures, keep the averages printable
+    }
+
+    printf("# bench %u moves, %u failed, %.0f moves/s wall\n", count, failed, (count * 1e3) / MAX(wall, 1e-3));
+    printf("# %-10s %10s %10s\n", "", "mean", "max");
+    printf("# %-10s %10.1f %10.1f\n", "time ms", duration / moves, duration_max);
+    printf("# %-10s %10.1f %10.1f\n", "|error|", error / moves, error_max);
+    printf("# %-10s %10.1f %10.1f\n", "overshoot", overshoot / moves, overshoot_max);
+
+    if (beyond > 0) {
+        printf("# expect failed, %u moves with an error beyond %.1f or an overshoot beyond %.1f\n", beyond, sim_errorLimit, sim_overshootLimit);
+    }
+}
+
+static bool sim_expect(const struct sim_move *move)
+{
+    // a rejected move is up to the script, one which does not finish fails
+    if ((move->ack != E_OK) || ((sim_errorLimit <= 0) && (sim_overshootLimit <= 0))) {
+        return true;
+    }
+
+    if ((move->done == true) && ((sim_errorLimit <= 0) || (fabs(move->error) <= sim_errorLimit)) && 
+        ((sim_overshootLimit <= 0) || (move->overshoot <= sim_overshootLimit))) {
+        return true;
+    }
+
+    sim_errorCount++;
+    return false;
+}
+
+static void sim_pipe(uint32_t count, uint8_t depth, uint8_t command)
+{
+    uint8_t frame[5];
+    uint32_t sent = 0;
+    uint64_t start, deadline;
+    double duration;
+
+    start = hal_now();
+    deadline = start + SIM_PIPE_TIMEOUT;
+    sim_sequenced = 0;
+    sim_outOfOrder = 0;
+    sim_sequence = 0;
+    sim_quiet = true;
+
+    while ((sim_sequenced < count) && (hal_now() < deadline))
+    {
+        // [STX] [SEQ] [CMD] [LEN] [CHECKSUM]
+        while ((sent < count) && ((sent - sim_sequenced) < depth))
+        {
+            frame[0] = HOST_STX_SEQUENCED;
+            frame[1] = (uint8_t) sent;
+            frame[2] = command;
+            frame[3] = 0;
+            frame[4] = (frame[0] ^ frame[1] ^ frame[2] ^ frame[3]);
+            hal_uart_inject(HAL_UART_HOST, frame, sizeof(frame), 0);
+            sent++;
+        }
+
+        sim_step(deadline);
+    }
+
+    sim_quiet = false;
+    duration = (double) (hal_now() - start) / HAL_NS_PER_MS;
+
+    printf("%10.3f  pipe %u requests, depth %u: %u answered in %.1f ms, %.0f requests/s, %u out of order\n",
+            (double) hal_now() / HAL_NS_PER_MS, count, depth, sim_sequenced, duration,
+            (sim_sequenced * 1e3) / MAX(duration, 1e-3), sim_outOfOrder);
+}
+
+static uint8_t sim_parseUnit(const char *token)
+{
+    if (token == NULL) {
+        return VDESK_UNITS;
+    } else if (strcmp(token, "left") == 0) {
+        return VDESK_LEFT;
+    } else if (strcmp(token, "right") == 0) {
+        return VDESK_RIGHT;
+    }
+
+    return VDESK_UNITS;
+}
+
+static void sim_printStats(void)
+{
+    const char *name[HAL_IRQ_MAX] = { "TMR0", "TX1", "RC1", "TX2", "RC2", "TMR2" };
+    const struct hal_stats *stats = hal_getStats();
+    const struct vdesk_stats *desk = vdesk_getStats();
+    uint8_t i;
+
+    printf("# %-6s %10s %12s\n", "irq", "count", "ns/isr");
+
+    for (i=0; i<HAL_IRQ_MAX; i++)
+    {
+        printf("# %-6s %10u %12.1f\n", name[i], stats->irq_count[i],
+                (stats->irq_timed[i] > 0) ? ((double) stats->irq_ns[i] / stats->irq_timed[i]) : 0.0);
+    }
+
+    printf("# lin  tx %u rx %u dropped %u\n", stats->uart_tx_bytes[HAL_UART_LIN],
+            stats->uart_rx_bytes[HAL_UART_LIN], stats->uart_rx_dropped[HAL_UART_LIN]);
+    printf("# host tx %u rx %u dropped %u\n", stats->uart_tx_bytes[HAL_UART_HOST],
+            stats->uart_rx_bytes[HAL_UART_HOST], stats->uart_rx_dropped[HAL_UART_HOST]);
+    printf("# nvm writes %u, watchdog resets %u, telemetry frames %u\n", stats->nvm_writes,
+            stats->wdt_resets, sim_pushes);
+    printf("# desk frames %u responses %u checksum errors %u dropped %u\n", desk->frames,
+            desk->responses, desk->checksum_errors, desk->dropped);
+}
+
+static void sim_printFrame(uint64_t time, const char *prefix, const uint8_t *frame, uint8_t length)
+{
+    uint8_t i;
+
+    printf("%10.3f  %s", (double) time / HAL_NS_PER_MS, prefix);
+
+    for (i=0; i<length; i++) {
+        printf(" %02X", frame[i]);
+    }
+
+    printf("\n");
+}
+
+
+/**********************************************************
+ * CALLBACK FUNCTIONS
+ *********************************************************/
+static void cb_host_byte(void *ctx, uint8_t byte, bool is_break)
+{
+    (void) ctx;
+    (void) is_break;
+
+    if ((host_frameCount == 0) && (byte != HOST_STX) && (byte != HOST_STX_SEQUENCED)) {
+        return;
+    }
+
+    host_frame[host_frameCount++] = byte;
+
+    // [STX] [SEQ] [CMD] [LEN] [DATA ...] [CHECKSUM]
+    if ((host_frame[0] == HOST_STX_SEQUENCED) && (host_frameCount > 3) && (host_frameCount == (host_frame[3] + 5)))
+    {
+        if (sim_quiet == false) {
+            sim_printFrame(hal_now(), "host <-", host_frame, host_frameCount);
+        }
+
+        if (host_frame[1] != sim_sequence) {
+            sim_outOfOrder++;
+        }
+
+        sim_sequence = (host_frame[1] + 1);
+        sim_sequenced++;
+        host_frameCount = 0;
+    }
+
+    // [STX] [CMD] [LEN] [DATA ...] [CHECKSUM]
+    else if ((host_frame[0] == HOST_STX) && (host_frameCount > 2) && (host_frameCount == (host_frame[2] + 4)))
+    {
+        if (sim_quiet == false) {
+            sim_printFrame(hal_now(), "host <-", host_frame, host_frameCount);
+        }
+
+        // pushed frames are no answer to the pending request
+        if (host_frame[1] == (PUSH_DESK_TELEMETRY | 0x80)) {
+            sim_pushes++;
+        } else {
+            memcpy(sim_response, host_frame, host_frameCount);
+            sim_responses++;
+        }
+        host_frameCount = 0;
+    }
+    else if (host_frameCount >= SIM_FRAME_LEN)
+    {
+        sim_printFrame(hal_now(), "host <- (overlong)", host_frame, host_frameCount);
+        host_frameCount = 0;
+    }
+}
+
+static void cb_lin_byte(void *ctx, uint8_t byte, bool is_break)
+{
+    (void) ctx;
+
+    if (is_break == true)
+    {
+        if ((sim_verbose == true) && (sim_quiet == false) && (lin_frameCount > 0)) {
+            sim_printFrame(lin_frameStart, "lin  ->", lin_frame, lin_frameCount);
+        }
+
+        lin_frameCount = 0;
+        lin_frameStart = hal_now();
+    }
+    else if (lin_frameCount < SIM_FRAME_LEN)
+    {
+        lin_frame[lin_frameCount++] = byte;
+    }
+
+    vdesk_onByte(byte, is_break);
+}
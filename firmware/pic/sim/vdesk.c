@@ -0,0 +1,537 @@
+/*
+ * File:   vdesk.c
+ * Author: sire
+ *
+ * Virtual Bekant desk. The bus decoder follows every frame the master sends
+ * (break, sync, protected id, data, checksum). Master frames are 0x3C
+ * (diagnostic request), node 17 (heartbeat) and node 18 (motor command). All
+ * other headers are answered by the slave owning that id, if there is one.
+ */
+#include <math.h>
+#include <string.h>
+#include "hal.h"
+#include "bekant.h"
+#include "lin.h"
+#include "vdesk.h"
+
+
+#define VDESK_DIAG_BROADCAST_A      0xFF
+#define VDESK_DIAG_BROADCAST_B      0xD0
+#define VDESK_DIAG_ANNOUNCE         0x07
+
+
+enum vdesk_bus_state {
+    BUS_IDLE,
+    BUS_SYNC,
+    BUS_PID,
+    BUS_DATA
+};
+
+
+static struct vmotor        vmotor[VDESK_UNITS];
+static struct vdesk_stats   stats;
+
+static enum vdesk_bus_state bus_state;
+static uint8_t              bus_pid;
+static uint8_t              bus_data[LIN_DIAG_PACKET_LEN];
+static uint8_t              bus_length, bus_count;
+
+static bool                 diag_pending;
+static uint8_t              diag_response[LIN_DIAG_PACKET_LEN];
+
+static double               load;               /**< share of the braking force the load adds going up and takes going down */
+static uint16_t             noise_permille;
+static uint32_t             noise_state;
+
+
+/**********************************************************
+ * HELPER FUNCTIONS
+ *********************************************************/
+static uint8_t vdesk_pid(uint8_t id)
+{
+    uint8_t p0, p1;
+
+    p0 = BIT(id,0) ^ BIT(id,1) ^ BIT(id,2) ^ BIT(id,4);
+    p1 = (~(BIT(id,1) ^ BIT(id,3) ^ BIT(id,4) ^ BIT(id,5))) & 1;
+
+    return (uint8_t) ((id & 0x3F) | (p0 << 6) | (p1 << 7));
+}
+
+static uint8_t vdesk_checksum(uint8_t pid, const uint8_t *data, uint8_t length, bool classic)
+{
+    uint8_t i;
+    uint16_t cc = (classic ? 0 : pid);
+
+    for (i=0; i<length; i++) {
+        cc += data[i];
+
+        if (cc > 255) {
+            cc -= 255;
+        }
+    }
+
+    return (uint8_t) ((~cc) & 0xFF);
+}
+
+static bool vdesk_noise(void)
+{
+    if (noise_permille == 0) {
+        return false;
+    }
+
+    // xorshift32
+    noise_state ^= noise_state << 13;
+    noise_state ^= noise_state >> 17;
+    noise_state ^= noise_state << 5;
+
+    return ((noise_state % 1000U) < noise_permille);
+}
+
+static void vdesk_respond(const uint8_t *data, uint8_t length, bool classic)
+{
+    uint8_t frame[LIN_DIAG_PACKET_LEN + 1];
+
+    if (vdesk_noise() == true) {
+        stats.dropped++;
+        return;
+    }
+
+    memcpy(frame, data, length);
+    frame[length] = vdesk_checksum(bus_pid, data, length, classic);
+
+    hal_uart_inject(HAL_UART_LIN, frame, (length + 1), VDESK_RESPONSE_DELAY_US);
+    stats.responses++;
+}
+
+static struct vmotor *vdesk_findNode(uint8_t node_id)
+{
+    uint8_t i;
+
+    for (i=0; i<VDESK_UNITS; i++) {
+        if ((vmotor[i].node_id != 0) && (vmotor[i].node_id == node_id)) {
+            return &vmotor[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**********************************************************
+ * MOTOR MODEL
+ *********************************************************/
+static double vmotor_targetVelocity(struct vmotor *m)
+{
+    double reference = (double) m->command_position;
+    double velocity;
+
+    switch (m->command)
+    {
+        case MOTOR_CMD_MOVE_UP:
+            // the leading motor slows down until the other one caught up
+            velocity = VMOTOR_SPEED_FAST;
+            if (m->position > (reference + VMOTOR_SYNC_TOLERANCE)) {
+                velocity *= VMOTOR_SYNC_FACTOR;
+            } break;
+
+        case MOTOR_CMD_MOVE_DOWN:
+            velocity = -VMOTOR_SPEED_FAST;
+            if (m->position < (reference - VMOTOR_SYNC_TOLERANCE)) {
+                velocity *= VMOTOR_SYNC_FACTOR;
+            } break;
+
+        case MOTOR_CMD_MOVE_SLOW:
+            if (m->velocity > 0) {
+                velocity = VMOTOR_SPEED_SLOW;
+            } else if (m->velocity < 0) {
+                velocity = -VMOTOR_SPEED_SLOW;
+            } else if (reference > m->position) {
+                velocity = VMOTOR_SPEED_SLOW;
+            } else if (reference < m->position) {
+                velocity = -VMOTOR_SPEED_SLOW;
+            } else {
+                velocity = 0;
+            } break;
+
+        case MOTOR_CMD_CALIBRATION:
+            velocity = -VMOTOR_SPEED_SLOW;
+            break;
+
+        default:
+            velocity = 0;
+            break;
+    }
+
+    return (velocity * m->speed_factor);
+}
+
+static void vmotor_step(struct vmotor *m, double dt)
+{
+    double target, delta, limit;
+
+    target = vmotor_targetVelocity(m);
+    delta = target - m->velocity;
+
+    if ((fabs(target) > fabs(m->velocity)) && ((target * m->velocity) >= 0)) {
+        limit = VMOTOR_ACCELERATION * dt;
+    } else {
+        // gravity helps to stop a loaded desk going up and works against it going down
+        limit = VMOTOR_DECELERATION * dt * ((m->velocity > 0) ? (1.0 + load) : (1.0 - load));
+    }
+
+    if (delta > limit) {
+        delta = limit;
+    } else if (delta < -limit) {
+        delta = -limit;
+    }
+
+    m->velocity += delta;
+    m->position += m->velocity * dt;
+
+    // mechanical end stops
+    if (m->position > m->upper_limit) {
+        m->position = m->upper_limit;
+        m->velocity = 0;
+    } else if (m->position < m->lower_limit) {
+        m->position = m->lower_limit;
+        m->velocity = 0;
+    }
+
+    m->peak_low = MIN(m->peak_low, m->position);
+    m->peak_high = MAX(m->peak_high, m->position);
+}
+
+static void vmotor_update(struct vmotor *m, uint64_t now)
+{
+    uint64_t step;
+
+    if ((m->blocked == true) && (m->blocked_until != 0) && (now >= m->blocked_until)) {
+        m->blocked = false;
+    }
+
+    while (m->updated < now)
+    {
+        step = MIN(VMOTOR_STEP_NS, (now - m->updated));
+
+        if (m->blocked == true) {
+            m->velocity = 0;
+        } else {
+            vmotor_step(m, (double) step / 1e9);
+        }
+
+        m->updated += step;
+    }
+
+    if (m->blocked == true) {
+        m->state = MOTOR_STATE_BLOCKED;
+    }
+    else if (m->command == MOTOR_CMD_CALIBRATION) {
+        if ((m->position <= m->lower_limit) && (m->velocity == 0)) {
+            m->state = MOTOR_STATE_CALIBRATED;
+        } else {
+            m->state = MOTOR_STATE_CALIBRATING;
+        }
+    }
+    else if (m->velocity != 0) {
+        m->state = (m->command == MOTOR_CMD_MOVE_SLOW) ? MOTOR_STATE_MOVING_SLOW : MOTOR_STATE_MOVING;
+    }
+    else {
+        m->state = MOTOR_STATE_IDLE;
+    }
+}
+
+static void vmotor_command(struct vmotor *m, const uint8_t *data)
+{
+    m->command_position = (uint16_t) ((data[1] << 8) | data[0]);
+    m->command = data[2];
+
+    if ((m->command == MOTOR_CMD_MOVE_STOP) && (m->blocked_until == 0)) {
+        m->blocked = false;
+    }
+}
+
+
+/**********************************************************
+ * FRAME HANDLING
+ *********************************************************/
+static void vdesk_diagRequest(const uint8_t *data)
+{
+    uint8_t i, reg, value;
+    struct vmotor *m = NULL;
+
+    diag_pending = false;
+    memset(diag_response, 0xFF, sizeof(diag_response));
+
+    if ((data[0] == VDESK_DIAG_BROADCAST_A) && (data[1] == VDESK_DIAG_ANNOUNCE))
+    {
+        // announcement: all nodes forget their identification
+        for (i=0; i<VDESK_UNITS; i++) {
+            vmotor[i].node_id = 0;
+        }
+        return;
+    }
+
+    if ((data[0] == VDESK_DIAG_BROADCAST_A) || (data[0] == VDESK_DIAG_BROADCAST_B)) {
+        return;
+    }
+
+    for (i=0; i<VDESK_UNITS; i++) {
+        if (vmotor[i].scan_slot == data[0]) {
+            m = &vmotor[i];
+        }
+    }
+
+    if (m == NULL) {
+        return;
+    }
+
+    switch (data[1])
+    {
+        case STARTUP_CMD_SCAN:
+            if (m->node_id == 0) {
+                diag_response[0] = data[0];
+                diag_response[1] = STARTUP_CMD_SCAN;
+                diag_pending = true;
+            } break;
+
+        case STARTUP_CMD_READ:
+            reg = data[2];
+            switch (reg)
+            {
+                case STARTUP_REG_09:                value = m->property; break;
+                case STARTUP_REG_LOWER_LIMIT_HI:    value = (m->lower_limit >> 8); break;
+                case STARTUP_REG_LOWER_LIMIT_LO:    value = (m->lower_limit & 0xFF); break;
+                case STARTUP_REG_UPPER_LIMIT_HI:    value = (m->upper_limit >> 8); break;
+                case STARTUP_REG_UPPER_LIMIT_LO:    value = (m->upper_limit & 0xFF); break;
+                default: return;
+            }
+            diag_response[0] = reg;
+            diag_response[1] = value;
+            diag_pending = true;
+            break;
+
+        case STARTUP_CMD_WRITE:
+            m->node_id = (DESK_ADDR_MOTOR_LEFT + data[2]);
+            diag_pending = true;
+            break;
+
+        default: break;
+    }
+}
+
+static void vdesk_masterFrame(uint8_t id, const uint8_t *data)
+{
+    uint8_t i;
+
+    if (id == LIN_NODE_DIAG_TX)
+    {
+        vdesk_diagRequest(data);
+    }
+    else if (id == DESK_ADDR_MASTER)
+    {
+        vdesk_update();
+
+        for (i=0; i<VDESK_UNITS; i++) {
+            if (vmotor[i].node_id != 0) {
+                vmotor_command(&vmotor[i], data);
+            }
+        }
+    }
+}
+
+static void vdesk_header(uint8_t id)
+{
+    uint8_t data[DESK_PACKET_LEN];
+    uint16_t position;
+    struct vmotor *m;
+
+    if (id == LIN_NODE_DIAG_RX)
+    {
+        if (diag_pending == true) {
+            diag_pending = false;
+            vdesk_respond(diag_response, LIN_DIAG_PACKET_LEN, true);
+        }
+    }
+    else if ((m = vdesk_findNode(id)) != NULL)
+    {
+        vmotor_update(m, hal_now());
+        position = (uint16_t) lround(m->position);
+
+        data[0] = (position & 0xFF);
+        data[1] = (position >> 8);
+        data[2] = m->state;
+
+        m->frames++;
+        vdesk_respond(data, DESK_PACKET_LEN, false);
+    }
+}
+
+
+/**********************************************************
+ * INTERFACE
+ *********************************************************/
+void vdesk_init(uint16_t position)
+{
+    uint8_t i;
+
+    memset(vmotor, 0, sizeof(vmotor));
+    memset(&stats, 0, sizeof(stats));
+
+    for (i=0; i<VDESK_UNITS; i++)
+    {
+        vmotor[i].property = 0x15;
+        vmotor[i].lower_limit = 0x0064;
+        vmotor[i].upper_limit = 0x1964;
+        vmotor[i].command = MOTOR_CMD_IDLE;
+        vmotor[i].position = position;
+        vmotor[i].peak_low = position;
+        vmotor[i].peak_high = position;
+        vmotor[i].speed_factor = 1.0;
+        vmotor[i].updated = hal_now();
+    }
+
+    // the scan slots are assigned by the motors themselves, only their order matters
+    vmotor[VDESK_LEFT].scan_slot = 2;
+    vmotor[VDESK_RIGHT].scan_slot = 5;
+
+    bus_state = BUS_IDLE;
+    diag_pending = false;
+    load = 0;
+    noise_permille = 0;
+}
+
+void vdesk_powerCycle(void)
+{
+    uint8_t i;
+
+    // the motors forget their identification but stay where they are
+    vdesk_update();
+
+    for (i=0; i<VDESK_UNITS; i++)
+    {
+        vmotor[i].node_id = 0;
+        vmotor[i].command = MOTOR_CMD_IDLE;
+        vmotor[i].velocity = 0;
+        vmotor[i].blocked = false;
+    }
+
+    bus_state = BUS_IDLE;
+    diag_pending = false;
+}
+
+void vdesk_onByte(uint8_t byte, bool is_break)
+{
+    uint8_t id;
+
+    if (is_break == true) {
+        bus_state = BUS_SYNC;
+        return;
+    }
+
+    switch (bus_state)
+    {
+        case BUS_SYNC:
+            bus_state = (byte == LIN_SYNC_FIELD) ? BUS_PID : BUS_IDLE;
+            break;
+
+        case BUS_PID:
+            id = (byte & 0x3F);
+            bus_pid = byte;
+            bus_count = 0;
+            bus_state = BUS_IDLE;
+            stats.frames++;
+
+            if (vdesk_pid(id) != byte) {
+                break;      // corrupted header, nobody answers
+            }
+
+            if (id == LIN_NODE_DIAG_TX) {
+                bus_length = LIN_DIAG_PACKET_LEN;
+                bus_state = BUS_DATA;
+            } else if ((id == DESK_ADDR_SEVENTEEN) || (id == DESK_ADDR_MASTER)) {
+                bus_length = DESK_PACKET_LEN;
+                bus_state = BUS_DATA;
+            } else {
+                vdesk_header(id);
+            }
+            break;
+
+        case BUS_DATA:
+            if (bus_count < bus_length)
+            {
+                bus_data[bus_count++] = byte;
+            }
+            else
+            {
+                id = (bus_pid & 0x3F);
+                bus_state = BUS_IDLE;
+
+                if (vdesk_checksum(bus_pid, bus_data, bus_length, (id == LIN_NODE_DIAG_TX)) == byte) {
+                    vdesk_masterFrame(id, bus_data);
+                } else {
+                    stats.checksum_errors++;
+                }
+            }
+            break;
+
+        default: break;
+    }
+}
+
+struct vmotor *vdesk_getMotor(uint8_t unit)
+{
+    return (unit < VDESK_UNITS) ? &vmotor[unit] : NULL;
+}
+
+const struct vdesk_stats *vdesk_getStats(void)
+{
+    return &stats;
+}
+
+void vdesk_update(void)
+{
+    uint8_t i;
+
+    for (i=0; i<VDESK_UNITS; i++) {
+        vmotor_update(&vmotor[i], hal_now());
+    }
+}
+
+bool vdesk_isResting(void)
+{
+    vdesk_update();
+
+    return ((vmotor[VDESK_LEFT].velocity == 0) && (vmotor[VDESK_RIGHT].velocity == 0));
+}
+
+void vdesk_setDrift(uint8_t unit, double speed_factor)
+{
+    if (unit < VDESK_UNITS) {
+        vmotor_update(&vmotor[unit], hal_now());
+        vmotor[unit].speed_factor = speed_factor;
+    }
+}
+
+void vdesk_block(uint8_t unit, uint32_t duration_ms)
+{
+    if (unit < VDESK_UNITS)
+    {
+        vmotor_update(&vmotor[unit], hal_now());
+        vmotor[unit].blocked = true;
+        vmotor[unit].velocity = 0;
+        vmotor[unit].state = MOTOR_STATE_BLOCKED;
+        vmotor[unit].blocked_until = (duration_ms > 0) ? (hal_now() + (duration_ms * HAL_NS_PER_MS)) : 0;
+    }
+}
+
+void vdesk_setLoad(double share)
+{
+    vdesk_update();
+    load = share;
+}
+
+void vdesk_setNoise(uint16_t drop_permille, uint32_t seed)
+{
+    noise_permille = drop_permille;
+    noise_state = (seed != 0) ? seed : 0x2545F491;
+}
@@ -0,0 +1,80 @@
+/*
+ * File:   vdesk.h
+ * Author: sire
+ *
+ * Virtual Bekant desk on the simulated LIN bus. Decodes the frames sent by the
+ * firmware on EUSART1, answers the diagnostic exchange (0x3C/0x3D) of the
+ * startup sequence and the operation frames of the motor nodes, and moves two
+ * motor models with velocity, inertia and individual drift.
+ */
+#ifndef VDESK_H
+#define	VDESK_H
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VMOTOR_SPEED_FAST           350.0       /**< position units (0.1 mm) per second */
+#define VMOTOR_SPEED_SLOW           90.0
+#define VMOTOR_ACCELERATION         1400.0      /**< units per second^2 */
+#define VMOTOR_DECELERATION         2200.0
+#define VMOTOR_SYNC_TOLERANCE       4           /**< lead on the reference position before slowing down */
+#define VMOTOR_SYNC_FACTOR          0.92
+#define VMOTOR_STEP_NS              1000000ULL  /**< physics integration step */
+
+#define VDESK_RESPONSE_DELAY_US     150         /**< response space between header and slave response */
+
+
+enum vdesk_unit {
+    VDESK_LEFT,
+    VDESK_RIGHT,
+    VDESK_UNITS
+};
+
+struct vmotor {
+    uint8_t     scan_slot;          /**< node counter the motor answers during the scan */
+    uint8_t     node_id;            /**< lin node id after identification, 0 if unidentified */
+    uint8_t     property;           /**< content of register 0x09 */
+    uint16_t    upper_limit;
+    uint16_t    lower_limit;
+
+    uint8_t     command;            /**< last motor command received from the master */
+    uint16_t    command_position;
+    uint8_t     state;
+
+    double      position;
+    double      velocity;
+    double      speed_factor;       /**< individual drift, 1.0 is nominal */
+    double      peak_low;           /**< travel extremes, reset by the harness */
+    double      peak_high;
+
+    bool        blocked;
+    uint64_t    blocked_until;      /**< 0 = until the next stop command */
+
+    uint64_t    updated;
+    uint32_t    frames;             /**< operation frames answered */
+};
+
+struct vdesk_stats {
+    uint32_t    frames;             /**< headers seen on the bus */
+    uint32_t    responses;
+    uint32_t    checksum_errors;    /**< frames of the master with invalid checksum */
+    uint32_t    dropped;            /**< responses suppressed by the noise model */
+};
+
+
+void            vdesk_init(uint16_t position);
+void            vdesk_powerCycle(void);
+void            vdesk_onByte(uint8_t byte, bool is_break);
+
+struct vmotor  *vdesk_getMotor(uint8_t unit);
+const struct vdesk_stats *vdesk_getStats(void);
+void            vdesk_update(void);
+bool            vdesk_isResting(void);
+
+void            vdesk_setDrift(uint8_t unit, double speed_factor);
+void            vdesk_block(uint8_t unit, uint32_t duration_ms);
+void            vdesk_setLoad(double share);
+void            vdesk_setNoise(uint16_t drop_permille, uint32_t seed);
+
+
+#endif	/* VDESK_H */